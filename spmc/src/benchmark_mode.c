@@ -1,43 +1,134 @@
 #include "benchmark_mode.h"
 #include "common.h"
 #include "file_mode.h"
+#include "ffq_prefetch.h"
+#include "local_queue.h"
+#include "ffq_threads.h"
+#include <pthread.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <time.h>
 
 // ===== BENCHMARK CONFIGURATION =====
 // Number of items to generate for benchmarking (adjust as needed)
 // This eliminates file I/O overhead and focuses purely on queue performance
 #define BENCHMARK_ITEMS 10000
+#define BENCHMARK_CITIES 100
+#define BENCHMARK_ICONS 10
+
+// Item i is stamped BENCHMARK_EPOCH_US + i (2025-05-01T00:00:00Z)
+#define BENCHMARK_EPOCH_US 1746057600000000LL
 
 // To use CSV file instead of generated data, see commented code in run_benchmark_producer()
 
+static bool mpi_enqueue(void* queue, const WeatherRecord* item) {
+    return ffq_enqueue((FFQHandle*)queue, *item);
+}
+
+static int mpi_enqueue_batch(void* queue, const WeatherRecord* items, int n) {
+    return ffq_enqueue_batch((FFQHandle*)queue, items, n);
+}
+
+static bool mpi_dequeue(void* queue, int consumer_id, WeatherRecord* item) {
+    return ffq_dequeue((FFQHandle*)queue, consumer_id, item);
+}
+
+static const BenchmarkQueueOps mpi_ops = {mpi_enqueue, mpi_enqueue_batch, mpi_dequeue};
+
+BenchmarkQueue benchmark_queue_mpi(FFQHandle* handle) {
+    BenchmarkQueue queue = {&mpi_ops, handle, handle, handle->wait};
+    return queue;
+}
+
+// The in-process queue has no batched path, and its calls always succeed
+static bool threads_enqueue(void* queue, const WeatherRecord* item) {
+    ffq_threads_enqueue((FFQThreadQueue*)queue, item);
+    return true;
+}
+
+static int threads_enqueue_batch(void* queue, const WeatherRecord* items, int n) {
+    for (int i = 0; i < n; i++) {
+        ffq_threads_enqueue((FFQThreadQueue*)queue, &items[i]);
+    }
+    return n;
+}
+
+static bool threads_dequeue(void* queue, int consumer_id, WeatherRecord* item) {
+    ffq_threads_dequeue((FFQThreadQueue*)queue, consumer_id, item);
+    return true;
+}
+
+static const BenchmarkQueueOps threads_ops = {threads_enqueue, threads_enqueue_batch, threads_dequeue};
+
+// Seconds on a monotonic clock, for threads that must not call MPI
+static double thread_time(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+// Time on the queue's clock: MPI_Wtime for the MPI queue, so stats of
+// all ranks compare, and a thread-safe clock for the in-process one
+static double benchmark_time(const BenchmarkQueue* queue) {
+    return queue->handle ? MPI_Wtime() : thread_time();
+}
+
 // Create a sentinel item to mark the end of the benchmark data
-WeatherData create_sentinel_item() {
-    WeatherData sentinel;
-    memset(&sentinel, 0, sizeof(WeatherData));
-    
-    // Special timestamp
-    strcpy(sentinel.timestamp, "9999-12-31T23:59:59.999999+00:00");
-    
-    // Use a special city name as the marker
-    strcpy(sentinel.city, SENTINEL_CITY);
+WeatherRecord create_sentinel_item() {
+    WeatherRecord sentinel;
+    memset(&sentinel, 0, sizeof(WeatherRecord));
     
-    // Other fields
+    // The flag is the marker, the other fields are out of range
     sentinel.aqi = -1;
-    strcpy(sentinel.weather_icon, "none");
     sentinel.wind_speed = -1.0;
-    sentinel.humidity = -1;
-    sentinel.valid = true;
+    sentinel.flags = WEATHER_RECORD_VALID | WEATHER_RECORD_SENTINEL;
     
     return sentinel;
 }
 
 // Check if an item is the sentinel
-bool is_sentinel_item(const WeatherData* item) {
+bool is_sentinel_item(const WeatherRecord* item) {
     return (item != NULL && 
-            item->valid && 
-            strcmp(item->city, SENTINEL_CITY) == 0);
+            (item->flags & WEATHER_RECORD_VALID) && 
+            (item->flags & WEATHER_RECORD_SENTINEL));
+}
+
+void fill_benchmark_dict(WeatherDict* dict) {
+    char name[WEATHER_DICT_MAX_LEN];
+    for (int i = 0; i < BENCHMARK_CITIES; i++) {
+        snprintf(name, sizeof(name), "City-%d", i);
+        weather_dict_intern(dict, name);
+    }
+    for (int i = 0; i < BENCHMARK_ICONS; i++) {
+        snprintf(name, sizeof(name), "Icon-%d", i);
+        weather_dict_intern(dict, name);
+    }
+}
+
+// Resolve the ids of the generated strings once, outside the timed loop
+static void resolve_benchmark_ids(WeatherDict* dict, uint16_t* city_ids, uint16_t* icon_ids) {
+    char name[WEATHER_DICT_MAX_LEN];
+    for (int i = 0; i < BENCHMARK_CITIES; i++) {
+        snprintf(name, sizeof(name), "City-%d", i);
+        city_ids[i] = weather_dict_intern(dict, name);
+    }
+    for (int i = 0; i < BENCHMARK_ICONS; i++) {
+        snprintf(name, sizeof(name), "Icon-%d", i);
+        icon_ids[i] = weather_dict_intern(dict, name);
+    }
+}
+
+// Simple sequential data - just populate with item number
+static void make_benchmark_item(WeatherRecord* data, int i, const uint16_t* city_ids, const uint16_t* icon_ids) {
+    memset(data, 0, sizeof(WeatherRecord));
+    data->timestamp_us = BENCHMARK_EPOCH_US + i;
+    data->city_id = city_ids[i % BENCHMARK_CITIES];  // Cycle through 100 cities
+    data->aqi = i % 500;  // AQI between 0-499
+    data->icon_id = icon_ids[i % BENCHMARK_ICONS];
+    data->wind_speed = (float)(i % 100);
+    data->humidity = i % 100;
+    data->flags = WEATHER_RECORD_VALID;
 }
 
 // Ensure the benchmark result directory exists
@@ -52,13 +143,20 @@ void ensure_benchmark_dir() {
 }
 
 // Run benchmark producer - generates simple sequential data for pure queue benchmarking
-void run_benchmark_producer(FFQueue* queue, const char* csv_file, int delay_ms, MPI_Win win, BenchmarkStats* stats, int num_consumers, FILE* result_file) {
-    printf("Benchmark producer started (generating %d items)\n", BENCHMARK_ITEMS);
+void run_benchmark_producer(const BenchmarkQueue* queue, WeatherDict* dict, MPI_Comm producers, const char* csv_file, int delay_ms, BenchmarkStats* stats, int num_consumers, int prefetch, FILE* result_file) {
+    int producer_id, num_producers;
+    MPI_Comm_rank(producers, &producer_id);
+    MPI_Comm_size(producers, &num_producers);
+    
+    printf("Benchmark producer %d started (generating %d items)\n", producer_id, BENCHMARK_ITEMS);
     if (result_file) {
-        fprintf(result_file, "Benchmark producer started (generating %d items)\n", BENCHMARK_ITEMS);
+        fprintf(result_file, "Benchmark producer %d started (generating %d items)\n", producer_id, BENCHMARK_ITEMS);
     }
     
-    stats->start_time = MPI_Wtime();
+    uint16_t city_ids[BENCHMARK_CITIES], icon_ids[BENCHMARK_ICONS];
+    resolve_benchmark_ids(dict, city_ids, icon_ids);
+    
+    stats->start_time = benchmark_time(queue);
     stats->items_processed = 0;
     
     // ===== PURE BENCHMARK MODE: Generate simple sequential data =====
@@ -66,17 +164,17 @@ void run_benchmark_producer(FFQueue* queue, const char* csv_file, int delay_ms,
     
     /* OPTION 1: Minimal overhead - fastest (uncomment to use)
     for (int i = 1; i <= BENCHMARK_ITEMS; i++) {
-        WeatherData data;
-        memset(&data, 0, sizeof(WeatherData));
+        WeatherRecord data;
+        memset(&data, 0, sizeof(WeatherRecord));
         
-        // Absolute minimal - just integer data, no string formatting
-        data.aqi = i;
+        // Absolute minimal - just integer data, no dictionary ids
+        data.aqi = i % 500;
         data.wind_speed = (float)i;
         data.humidity = i % 100;
-        data.valid = true;
-        // Leave strings empty (already zeroed by memset)
+        data.flags = WEATHER_RECORD_VALID;
+        // Leave ids at the empty string (already zeroed by memset)
         
-        ffq_enqueue(queue, data, win);
+        ffq_enqueue(handle, data);
         stats->items_processed++;
         
         if (stats->items_processed % 1000 == 0) {
@@ -89,24 +187,33 @@ void run_benchmark_producer(FFQueue* queue, const char* csv_file, int delay_ms,
     }
     */
     
-    // OPTION 2: Simple formatted data (current - balanced approach)
-    for (int i = 1; i <= BENCHMARK_ITEMS; i++) {
-        WeatherData data;
-        memset(&data, 0, sizeof(WeatherData));
+    // OPTION 2: Simple sequential data (current - balanced approach)
+    // Without a delay every item is ready immediately, so items are
+    // generated and enqueued in batches. Producers split the items by
+    // number, producer p taking the items i with i % n == p.
+    WeatherRecord batch[ENQUEUE_BATCH_SIZE];
+    int batch_limit = delay_ms > 0 ? 1 : ENQUEUE_BATCH_SIZE;
+    int batch_count = 0;
+    int first = producer_id > 0 ? producer_id : num_producers;
+    
+    for (int i = first; i <= BENCHMARK_ITEMS; i += num_producers) {
+        make_benchmark_item(&batch[batch_count++], i, city_ids, icon_ids);
         
-        // Simple sequential data - just populate with item number
-        snprintf(data.timestamp, MAX_TIMESTAMP_LEN, "Item-%d", i);
-        snprintf(data.city, MAX_CITY_LEN, "City-%d", i % 100);  // Cycle through 100 cities
-        data.aqi = i % 500;  // AQI between 0-499
-        snprintf(data.weather_icon, MAX_ICON_LEN, "Icon-%d", i % 10);
-        data.wind_speed = (float)(i % 100);
-        data.humidity = i % 100;
-        data.valid = true;
+        if (batch_count < batch_limit && i + num_producers <= BENCHMARK_ITEMS) {
+            continue;
+        }
         
-        ffq_enqueue(queue, data, win);
-        stats->items_processed++;
+        if (batch_count == 1) {
+            queue->ops->enqueue(queue->queue, &batch[0]);
+        } else {
+            queue->ops->enqueue_batch(queue->queue, batch, batch_count);
+        }
         
-        if (stats->items_processed % 1000 == 0) {
+        int before = stats->items_processed;
+        stats->items_processed += batch_count;
+        batch_count = 0;
+        
+        if (stats->items_processed / 1000 != before / 1000) {
             printf("Enqueued %d items...\n", stats->items_processed);
         }
         
@@ -142,7 +249,9 @@ void run_benchmark_producer(FFQueue* queue, const char* csv_file, int delay_ms,
         memset(&data, 0, sizeof(WeatherData));
         
         if (parse_csv_line(line, &data)) {
-            ffq_enqueue(queue, data, win);
+            WeatherRecord record;
+            weather_record_pack(dict, &data, &record);
+            ffq_enqueue(handle, record);
             stats->items_processed++;
             
             if (stats->items_processed % 100 == 0) {
@@ -157,30 +266,52 @@ void run_benchmark_producer(FFQueue* queue, const char* csv_file, int delay_ms,
     fclose(file);
     */
     
-    // Add sentinel values - one for each consumer
-    WeatherData sentinel = create_sentinel_item();
-    for (int i = 0; i < num_consumers; i++) {
-        ffq_enqueue(queue, sentinel, win);
-    }
-    printf("Enqueued %d sentinel items - one for each consumer\n", num_consumers);
-    if (result_file) {
-        fprintf(result_file, "Enqueued %d sentinel items - one for each consumer\n", num_consumers);
+    // Sentinels must follow every item, so they wait for all producers
+    int total_items = 0;
+    MPI_Barrier(producers);
+    MPI_Reduce(&stats->items_processed, &total_items, 1, MPI_INT, MPI_SUM, 0, producers);
+    if (producer_id == 0) {
+        // Add sentinel values - one for each consumer, or one for each
+        // rank a prefetching consumer may hold when it meets its first
+        int num_sentinels = num_consumers * (prefetch > 0 ? prefetch : 1);
+        WeatherRecord sentinel = create_sentinel_item();
+        for (int i = 0; i < ENQUEUE_BATCH_SIZE; i++) {
+            batch[i] = sentinel;
+        }
+        for (int sent = 0; sent < num_sentinels; sent += ENQUEUE_BATCH_SIZE) {
+            int remaining = num_sentinels - sent;
+            queue->ops->enqueue_batch(queue->queue, batch, 
+                                      remaining < ENQUEUE_BATCH_SIZE ? remaining : ENQUEUE_BATCH_SIZE);
+        }
+        if (prefetch > 0) {
+            printf("Enqueued %d sentinel items - %d for each consumer\n", num_sentinels, prefetch);
+            if (result_file) {
+                fprintf(result_file, "Enqueued %d sentinel items - %d for each consumer\n", num_sentinels, prefetch);
+            }
+        } else {
+            printf("Enqueued %d sentinel items - one for each consumer\n", num_consumers);
+            if (result_file) {
+                fprintf(result_file, "Enqueued %d sentinel items - one for each consumer\n", num_consumers);
+            }
+        }
+        
+        // Signal that producer is done
+        if (queue->handle) {
+            FFQHandle* handle = queue->handle;
+            ffq_publish_tail(handle);
+            int producer_done = 1;
+            
+            // Store the total number of items in the queue's lastItemDequeued field
+            // This serves as a flag to consumers that producer is done
+            // (atomic, since consumers update the same counter concurrently)
+            MPI_Accumulate(&total_items, 1, MPI_INT, 0, 
+                           FFQ_FIELD_DISP(handle, lastItemDequeued), 
+                           1, MPI_INT, MPI_REPLACE, handle->win);
+            MPI_Win_flush(0, handle->win);
+        }
     }
     
-    // Signal that producer is done
-    int producer_done = 1;
-    int total_items = stats->items_processed;
-    
-    MPI_Win_lock(MPI_LOCK_EXCLUSIVE, 0, 0, win);
-    // Store the total number of items in the queue's lastItemDequeued field
-    // This serves as a flag to consumers that producer is done
-    MPI_Put(&total_items, 1, MPI_INT, 0, 
-            offsetof(FFQueue, lastItemDequeued), 
-            1, MPI_INT, win);
-    MPI_Win_flush(0, win);
-    MPI_Win_unlock(0, win);
-    
-    stats->end_time = MPI_Wtime();
+    stats->end_time = benchmark_time(queue);
     double duration = stats->end_time - stats->start_time;
     stats->throughput = duration > 0 ? stats->items_processed / duration : 0;
     
@@ -197,22 +328,115 @@ void run_benchmark_producer(FFQueue* queue, const char* csv_file, int delay_ms,
     }
 }
 
+// Count one item, then work on it
+static void process_benchmark_item(int consumer_id, int delay_ms, BenchmarkStats* stats) {
+    stats->items_processed++;
+    
+    if (stats->items_processed % 100 == 0) {
+        printf("Consumer %d processed %d items...\n", consumer_id, stats->items_processed);
+    }
+    
+    // Optional processing delay
+    if (delay_ms > 0) {
+        do_work(delay_ms);
+    }
+}
+
+// Worker thread of a hybrid consumer rank. Workers make no MPI calls.
+typedef struct
+{
+    pthread_t thread;
+    LocalQueue *queue;
+    WaitPolicy wait;
+    int consumer_id;
+    int delay_ms;
+    BenchmarkStats stats;  // Only items_processed is used
+} BenchmarkWorker;
+
+static void* run_benchmark_worker(void* arg) {
+    BenchmarkWorker* worker = (BenchmarkWorker*)arg;
+    WeatherRecord item;
+    Waiter waiter;
+    waiter_init(&waiter, &worker->wait);
+    
+    while (true) {
+        bool closed = local_queue_closed(worker->queue);
+        if (local_queue_pop(worker->queue, &item)) {
+            waiter_reset(&waiter);
+            process_benchmark_item(worker->consumer_id, worker->delay_ms, &worker->stats);
+        } else if (closed) {
+            break;
+        } else {
+            waiter_pause(&waiter);
+        }
+    }
+    return NULL;
+}
+
+// Process a dequeued item on this thread, or hand it to the workers if
+// there are any, waiting while their queue is full
+static void consume_benchmark_item(LocalQueue* local, const WaitPolicy* wait, int consumer_id, 
+                                   int delay_ms, BenchmarkStats* stats, const WeatherRecord* item) {
+    if (local == NULL) {
+        process_benchmark_item(consumer_id, delay_ms, stats);
+        return;
+    }
+    
+    Waiter waiter;
+    waiter_init(&waiter, wait);
+    while (!local_queue_push(local, item)) {
+        waiter_pause(&waiter);
+    }
+}
+
 // Run benchmark consumer - processes items concurrently with producer
-void run_benchmark_consumer(FFQueue* queue, int consumer_id, int delay_ms, MPI_Win win, BenchmarkStats* stats, FILE* result_file) {
+void run_benchmark_consumer(const BenchmarkQueue* queue, int consumer_id, int delay_ms, int prefetch, int threads,
+                            BenchmarkStats* stats, FILE* result_file) {
     printf("Benchmark consumer %d started\n", consumer_id);
     if (result_file) {
         fprintf(result_file, "Benchmark consumer %d started\n", consumer_id);
     }
     
-    stats->start_time = MPI_Wtime();
+    stats->start_time = benchmark_time(queue);
     stats->items_processed = 0;
     
+    // OPTIMIZATION: Hybrid consumer. This thread is the rank's only queue
+    // client and feeds worker threads through a local lock-free queue, so
+    // one RMA client serves a whole node's cores. Two slots per worker
+    // keep them busy while the next item is fetched, without holding back
+    // much work from other ranks.
+    LocalQueue* local = NULL;
+    BenchmarkWorker workers[threads > 0 ? threads : 1];
+    if (threads > 0) {
+        local = local_queue_create(2 * threads);
+        for (int i = 0; i < threads; i++) {
+            workers[i].queue = local;
+            workers[i].wait = queue->wait;
+            workers[i].consumer_id = consumer_id;
+            workers[i].delay_ms = delay_ms;
+            workers[i].stats.items_processed = 0;
+            pthread_create(&workers[i].thread, NULL, run_benchmark_worker, &workers[i]);
+        }
+    }
+    
     bool found_sentinel = false;
+    Waiter waiter;
+    waiter_init(&waiter, &queue->wait);
+    
+    // With prefetch the next items are claimed and fetched while the
+    // current one is processed
+    FFQPrefetch* window = NULL;
+    if (prefetch > 0 && queue->handle) {
+        window = ffq_prefetch_create(queue->handle, consumer_id, prefetch);
+        ffq_prefetch_fill(window);
+    }
     
     while (!found_sentinel) {
         // Try to dequeue an item
-        WeatherData item;
-        if (ffq_dequeue(queue, consumer_id, &item, win)) {
+        WeatherRecord item;
+        bool dequeued = window ? ffq_prefetch_take(window, &item) 
+                               : queue->ops->dequeue(queue->queue, consumer_id, &item);
+        if (dequeued) {
             // Check if this is the sentinel
             if (is_sentinel_item(&item)) {
                 printf("Consumer %d found sentinel, benchmark complete\n", consumer_id);
@@ -223,24 +447,43 @@ void run_benchmark_consumer(FFQueue* queue, int consumer_id, int delay_ms, MPI_W
                 break;
             }
             
-            // Process the item
-            stats->items_processed++;
-            
-            if (stats->items_processed % 100 == 0) {
-                printf("Consumer %d processed %d items...\n", consumer_id, stats->items_processed);
-            }
-            
-            // Optional processing delay
-            if (delay_ms > 0) {
-                do_work(delay_ms);
+            // Process the item, claiming its replacement first
+            waiter_reset(&waiter);
+            if (window) {
+                ffq_prefetch_fill(window);
             }
+            consume_benchmark_item(local, &queue->wait, consumer_id, delay_ms, stats, &item);
         } else {
-            // Small wait if nothing to dequeue
-            do_work(10);
+            // Wait before trying again if nothing could be dequeued
+            if (window) {
+                ffq_prefetch_fill(window);
+            }
+            waiter_pause(&waiter);
+        }
+    }
+    
+    if (window) {
+        // The rest of the window holds ranks claimed by this consumer: more
+        // sentinels, or items that overtook the sentinel after a skipped rank
+        while (window->active > 0) {
+            WeatherRecord item;
+            if (ffq_prefetch_take(window, &item) && !is_sentinel_item(&item)) {
+                consume_benchmark_item(local, &queue->wait, consumer_id, delay_ms, stats, &item);
+            }
         }
+        ffq_prefetch_free(window);
     }
     
-    stats->end_time = MPI_Wtime();
+    if (local) {
+        local_queue_close(local);
+        for (int i = 0; i < threads; i++) {
+            pthread_join(workers[i].thread, NULL);
+            stats->items_processed += workers[i].stats.items_processed;
+        }
+        local_queue_free(local);
+    }
+    
+    stats->end_time = benchmark_time(queue);
     double duration = stats->end_time - stats->start_time;
     stats->throughput = duration > 0 ? stats->items_processed / duration : 0;
     
@@ -255,4 +498,85 @@ void run_benchmark_consumer(FFQueue* queue, int consumer_id, int delay_ms, MPI_W
         fprintf(result_file, "  Processing time: %.3f seconds\n", duration);
         fprintf(result_file, "  Processing rate: %.2f items/second\n", stats->throughput);
     }
-} 
\ No newline at end of file
+} 
+
+// Consumer thread of the threads benchmark
+typedef struct
+{
+    pthread_t thread;
+    const BenchmarkQueue *queue;
+    int consumer_id;
+    int delay_ms;
+    BenchmarkStats stats;
+} ThreadsConsumer;
+
+static void* run_threads_consumer(void* arg) {
+    ThreadsConsumer* consumer = (ThreadsConsumer*)arg;
+    run_benchmark_consumer(consumer->queue, consumer->consumer_id, consumer->delay_ms, 0, 0,
+                           &consumer->stats, NULL);
+    return NULL;
+}
+
+void run_threads_benchmark(WeatherDict* dict, int num_consumers, int queue_size, int producer_delay_ms,
+                           int consumer_delay_ms, const WaitPolicy* wait, FILE* result_file) {
+    FFQThreadQueue* threads_queue = ffq_threads_create(queue_size, wait);
+    BenchmarkQueue queue = {&threads_ops, threads_queue, NULL, *wait};
+    ThreadsConsumer consumers[num_consumers];
+    
+    // Consumers are numbered from 1, as consumer ranks are
+    for (int i = 0; i < num_consumers; i++) {
+        consumers[i].queue = &queue;
+        consumers[i].consumer_id = i + 1;
+        consumers[i].delay_ms = consumer_delay_ms;
+        pthread_create(&consumers[i].thread, NULL, run_threads_consumer, &consumers[i]);
+    }
+    
+    // This thread is the only producer, in a communicator of its own
+    BenchmarkStats producer_stats;
+    run_benchmark_producer(&queue, dict, MPI_COMM_SELF, NULL, producer_delay_ms, &producer_stats,
+                           num_consumers, 0, result_file);
+    
+    int total_processed = 0;
+    double end_time = producer_stats.end_time;
+    for (int i = 0; i < num_consumers; i++) {
+        pthread_join(consumers[i].thread, NULL);
+        total_processed += consumers[i].stats.items_processed;
+        if (consumers[i].stats.end_time > end_time) {
+            end_time = consumers[i].stats.end_time;
+        }
+    }
+    ffq_threads_free(threads_queue);
+    
+    double total_duration = end_time - producer_stats.start_time;
+    double producer_time = producer_stats.end_time - producer_stats.start_time;
+    double throughput = total_duration > 0 ? producer_stats.items_processed / total_duration : 0;
+    printf("\nThreads Benchmark Results:\n");
+    printf("-----------------------------------\n");
+    printf("Total items produced: %d\n", producer_stats.items_processed);
+    printf("Total items consumed: %d\n", total_processed);
+    printf("Total benchmark time: %.3f seconds\n", total_duration);
+    printf("Producer time: %.3f seconds\n", producer_time);
+    for (int i = 0; i < num_consumers; i++) {
+        printf("Consumer %d: %d items, %.2f items/sec, time: %.3f sec\n", 
+               consumers[i].consumer_id, consumers[i].stats.items_processed, consumers[i].stats.throughput,
+               consumers[i].stats.end_time - consumers[i].stats.start_time);
+    }
+    printf("\nOverall throughput: %.2f items/second\n", throughput);
+    printf("-----------------------------------\n");
+    
+    if (result_file) {
+        fprintf(result_file, "\nThreads Benchmark Results:\n");
+        fprintf(result_file, "-----------------------------------\n");
+        fprintf(result_file, "Total items produced: %d\n", producer_stats.items_processed);
+        fprintf(result_file, "Total items consumed: %d\n", total_processed);
+        fprintf(result_file, "Total benchmark time: %.3f seconds\n", total_duration);
+        fprintf(result_file, "Producer time: %.3f seconds\n", producer_time);
+        for (int i = 0; i < num_consumers; i++) {
+            fprintf(result_file, "Consumer %d: %d items, %.2f items/sec, time: %.3f sec\n", 
+                    consumers[i].consumer_id, consumers[i].stats.items_processed, consumers[i].stats.throughput,
+                    consumers[i].stats.end_time - consumers[i].stats.start_time);
+        }
+        fprintf(result_file, "\nOverall throughput: %.2f items/second\n", throughput);
+        fprintf(result_file, "-----------------------------------\n");
+    }
+}
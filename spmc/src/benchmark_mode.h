@@ -6,6 +6,7 @@
 #include <mpi.h>
 #include "ffq.h"
 #include "weather_data.h"
+#include "weather_dict.h"
 
 // Benchmark statistics
 typedef struct
@@ -16,11 +17,36 @@ typedef struct
     double throughput;
 } BenchmarkStats;
 
+// Operations the benchmark runs through, so that the same producer and
+// consumer drive the MPI queue (benchmark mode) and the in-process queue
+// (threads mode)
+typedef struct
+{
+    bool (*enqueue)(void *queue, const WeatherRecord *item);
+    int (*enqueue_batch)(void *queue, const WeatherRecord *items, int n);
+    bool (*dequeue)(void *queue, int consumer_id, WeatherRecord *item);
+} BenchmarkQueueOps;
+
+// A queue as seen by the benchmark
+typedef struct
+{
+    const BenchmarkQueueOps *ops;
+    void *queue;
+    FFQHandle *handle; // The MPI queue, NULL for the in-process one
+    WaitPolicy wait;   // How the benchmark's retry loops wait
+} BenchmarkQueue;
+
+// The benchmark's view of an MPI queue
+BenchmarkQueue benchmark_queue_mpi(FFQHandle *handle);
+
 // Create a sentinel item to mark the end of the benchmark data
-WeatherData create_sentinel_item(void);
+WeatherRecord create_sentinel_item(void);
 
 // Check if an item is the sentinel
-bool is_sentinel_item(const WeatherData *item);
+bool is_sentinel_item(const WeatherRecord *item);
+
+// Add the generated cities and icons to the dictionary
+void fill_benchmark_dict(WeatherDict *dict);
 
 // Ensure the benchmark result directory exists
 void ensure_benchmark_dir(void);
@@ -28,11 +54,29 @@ void ensure_benchmark_dir(void);
 // Run benchmark producer - generates simple sequential data for pure queue benchmarking
 // NOTE: Currently generates 10000 items in-memory (no file I/O for pure performance testing)
 // To use CSV file instead, see commented code in benchmark_mode.c
-void run_benchmark_producer(FFQueue *queue, const char *csv_file, int delay_ms,
-                            MPI_Win win, BenchmarkStats *stats, int num_consumers, FILE *result_file);
+// With several producers (the ranks of producers) each one generates every
+// n-th item and the first one enqueues the sentinels once all are done:
+// one per consumer, or prefetch per consumer so every rank a prefetching
+// consumer claimed ahead gets one.
+void run_benchmark_producer(const BenchmarkQueue *queue, WeatherDict *dict, MPI_Comm producers,
+                            const char *csv_file, int delay_ms,
+                            BenchmarkStats *stats, int num_consumers, int prefetch,
+                            FILE *result_file);
+
+// Run benchmark consumer - processes items concurrently with producer.
+// With prefetch > 0 up to prefetch items are dequeued ahead (see ffq_prefetch.h;
+// MPI queue only). With threads > 0 the calling thread only dequeues and
+// that many worker threads process the items (MPI must provide
+// MPI_THREAD_FUNNELED). Makes no MPI call on the in-process queue.
+void run_benchmark_consumer(const BenchmarkQueue *queue, int consumer_id, int delay_ms, int prefetch,
+                            int threads, BenchmarkStats *stats, FILE *result_file);
 
-// Run benchmark consumer - processes items concurrently with producer
-void run_benchmark_consumer(FFQueue *queue, int consumer_id, int delay_ms,
-                            MPI_Win win, BenchmarkStats *stats, FILE *result_file);
+// Run the benchmark inside this process, without MPI between its threads:
+// the calling thread runs run_benchmark_producer and num_consumers threads
+// run run_benchmark_consumer over an in-process FFQ (see ffq_threads.h).
+// An upper bound for what the MPI queue can reach. Results are also
+// written to result_file unless it is NULL.
+void run_threads_benchmark(WeatherDict *dict, int num_consumers, int queue_size, int producer_delay_ms,
+                           int consumer_delay_ms, const WaitPolicy *wait, FILE *result_file);
 
 #endif // BENCHMARK_MODE_H
\ No newline at end of file
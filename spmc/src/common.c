@@ -3,23 +3,65 @@
 void print_usage(char* program_name) {
     printf("Usage: %s [options]\n", program_name);
     printf("Options:\n");
-    printf("  --mode=<test|benchmark|file> Run mode (default: test)\n");
+    printf("  --mode=<test|benchmark|file|threads|pipeline>\n");
+    printf("                               Run mode (default: test); threads runs the\n");
+    printf("                               benchmark in one process, without MPI;\n");
+    printf("                               pipeline filters test records through two\n");
+    printf("                               queues (at least 3 processes)\n");
     printf("  --queue-size=<size>          Size of the queue (default: %d)\n", DEFAULT_QUEUE_SIZE);
+    printf("  --max-queue-size=<size>      Let the producer resize the queue between\n");
+    printf("                               --queue-size and this size (default: fixed)\n");
     printf("  --items=<count>              Number of items to produce (default: %d)\n", DEFAULT_ITEMS);
     printf("  --producer-delay=<ms>        Producer delay in ms (default: 50)\n");
     printf("  --consumer-delay=<ms>        Consumer delay in ms (default: 200)\n");
     printf("  --csv-file=<file>            CSV file to read data from\n");
+    printf("  --layout=<central|sharded|inbox> Cell placement (default: central)\n");
+    printf("  --wait=<spin|yield|backoff[:min,max]|block[:min,max]>\n");
+    printf("                               How idle loops wait, bounds in us (default: block:%d,%d)\n",
+           WAIT_DEFAULT_MIN_US, WAIT_DEFAULT_MAX_US);
+    printf("  --producers=<count>          Number of producer ranks (default: 1)\n");
+    printf("  --priority-aqi=<aqi>         Send records with at least this AQI through a\n");
+    printf("                               priority lane (default: no lane)\n");
+    printf("  --priority-size=<size>       Size of the priority lane (default: %d)\n", DEFAULT_PRIORITY_SIZE);
+    printf("  --prefetch=<count>           Items each consumer dequeues ahead while\n");
+    printf("                               processing (default: 0)\n");
+    printf("  --steal                      Let idle consumers take items from other\n");
+    printf("                               consumers' inboxes (inbox layout)\n");
+    printf("  --spill-file=<file>          File mode: spill records to this file while\n");
+    printf("                               the queue is full (default: pause reading)\n");
+    printf("  --threads=<count>            Benchmark mode: worker threads processing the\n");
+    printf("                               items of each consumer rank (default: 0)\n");
+    printf("                               Threads mode: consumer threads (default: %d)\n",
+           DEFAULT_THREAD_CONSUMERS);
     printf("  --help                       Display this help and exit\n");
 }
 
+const char* layout_name(FFQLayout layout) {
+    switch (layout) {
+        case FFQ_LAYOUT_SHARDED: return "sharded";
+        case FFQ_LAYOUT_INBOX: return "inbox";
+        default: return "central";
+    }
+}
+
 void parse_args(int argc, char** argv, ProgramConfig* config) {
     // Set defaults
     config->queue_size = DEFAULT_QUEUE_SIZE;
+    config->max_queue_size = 0;
     config->num_items = DEFAULT_ITEMS;
     config->mode = TEST_MODE;
     config->producer_delay_ms = 50;
     config->consumer_delay_ms = 200;
     strcpy(config->csv_file, "test_data.csv");
+    config->layout = FFQ_LAYOUT_CENTRAL;
+    config->wait = wait_policy_default();
+    config->producers = 1;
+    config->priority_aqi = -1;
+    config->priority_size = DEFAULT_PRIORITY_SIZE;
+    config->prefetch = 0;
+    config->steal = false;
+    config->spill_file[0] = '\0';
+    config->threads = 0;
     
     // Parse arguments
     for (int i = 1; i < argc; i++) {
@@ -29,7 +71,13 @@ void parse_args(int argc, char** argv, ProgramConfig* config) {
                 strcpy(config->csv_file, "storage/benchmark.csv");
             } else if (strcmp(argv[i] + 7, "file") == 0) {
                 config->mode = FILE_MODE;
+            } else if (strcmp(argv[i] + 7, "threads") == 0) {
+                config->mode = THREADS_MODE;
+            } else if (strcmp(argv[i] + 7, "pipeline") == 0) {
+                config->mode = PIPELINE_MODE;
             }
+        } else if (strncmp(argv[i], "--max-queue-size=", 17) == 0) {
+            config->max_queue_size = atoi(argv[i] + 17);
         } else if (strncmp(argv[i], "--queue-size=", 13) == 0) {
             config->queue_size = atoi(argv[i] + 13);
         } else if (strncmp(argv[i], "--items=", 8) == 0) {
@@ -41,6 +89,37 @@ void parse_args(int argc, char** argv, ProgramConfig* config) {
         } else if (strncmp(argv[i], "--csv-file=", 11) == 0) {
             strncpy(config->csv_file, argv[i] + 11, 255);
             config->csv_file[255] = '\0';
+        } else if (strncmp(argv[i], "--layout=", 9) == 0) {
+            if (strcmp(argv[i] + 9, "sharded") == 0) {
+                config->layout = FFQ_LAYOUT_SHARDED;
+            } else if (strcmp(argv[i] + 9, "inbox") == 0) {
+                config->layout = FFQ_LAYOUT_INBOX;
+            } else if (strcmp(argv[i] + 9, "central") == 0) {
+                config->layout = FFQ_LAYOUT_CENTRAL;
+            } else {
+                printf("Unknown layout: %s\n", argv[i] + 9);
+                MPI_Abort(MPI_COMM_WORLD, 1);
+            }
+        } else if (strncmp(argv[i], "--wait=", 7) == 0) {
+            if (!wait_policy_parse(argv[i] + 7, &config->wait)) {
+                printf("Unknown wait policy: %s\n", argv[i] + 7);
+                MPI_Abort(MPI_COMM_WORLD, 1);
+            }
+        } else if (strncmp(argv[i], "--producers=", 12) == 0) {
+            config->producers = atoi(argv[i] + 12);
+        } else if (strncmp(argv[i], "--priority-aqi=", 15) == 0) {
+            config->priority_aqi = atoi(argv[i] + 15);
+        } else if (strncmp(argv[i], "--priority-size=", 16) == 0) {
+            config->priority_size = atoi(argv[i] + 16);
+        } else if (strncmp(argv[i], "--prefetch=", 11) == 0) {
+            config->prefetch = atoi(argv[i] + 11);
+        } else if (strcmp(argv[i], "--steal") == 0) {
+            config->steal = true;
+        } else if (strncmp(argv[i], "--spill-file=", 13) == 0) {
+            strncpy(config->spill_file, argv[i] + 13, 255);
+            config->spill_file[255] = '\0';
+        } else if (strncmp(argv[i], "--threads=", 10) == 0) {
+            config->threads = atoi(argv[i] + 10);
         } else if (strcmp(argv[i], "--help") == 0) {
             print_usage(argv[0]);
             MPI_Abort(MPI_COMM_WORLD, 0);
@@ -57,6 +136,31 @@ void parse_args(int argc, char** argv, ProgramConfig* config) {
         MPI_Abort(MPI_COMM_WORLD, 1);
     }
     
+    if (config->max_queue_size != 0 && config->max_queue_size < config->queue_size) {
+        printf("Max queue size must be at least the queue size\n");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    
+    if (config->producers < 1) {
+        printf("Number of producers must be at least 1\n");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    
+    if (config->priority_size < 2 || config->priority_size > MAX_PRIORITY_SIZE) {
+        printf("Priority lane size must be between 2 and %d\n", MAX_PRIORITY_SIZE);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    
+    if (config->prefetch < 0) {
+        printf("Prefetch must not be negative\n");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    
+    if (config->threads < 0) {
+        printf("Number of worker threads must not be negative\n");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    
     if (config->num_items < 1) {
         printf("Number of items must be at least 1\n");
         MPI_Abort(MPI_COMM_WORLD, 1);
@@ -10,35 +10,53 @@
 #include <mpi.h>
 #include <sys/stat.h>
 #include <time.h>
+#include "ffq.h"
 
 #define DEFAULT_QUEUE_SIZE 4
 #define DEFAULT_ITEMS 10
 #define MAX_LINE_LENGTH 1024
+#define DEFAULT_PRIORITY_SIZE 16
+#define MAX_PRIORITY_SIZE 4096 // Alerts are rare, a larger lane only wastes window memory
+#define DEFAULT_THREAD_CONSUMERS 3 // Consumer threads of the threads benchmark
 
-// Special identifier for sentinel value
-#define SENTINEL_CITY "##BENCHMARK_END##"
 #define BENCHMARK_RESULT_FILE "benchmark_result/benchmark.txt"
 
 typedef enum
 {
     TEST_MODE,
     BENCHMARK_MODE,
-    FILE_MODE
+    FILE_MODE,
+    THREADS_MODE,   // Benchmark inside one process, without MPI
+    PIPELINE_MODE   // Two queues in a registry: source, filters, sink
 } RunMode;
 
 typedef struct
 {
     int queue_size;
+    int max_queue_size;    // Resizable queue up to this size, 0 for a fixed size
     int num_items;
     RunMode mode;
     int producer_delay_ms;
     int consumer_delay_ms;
     char csv_file[256];
+    FFQLayout layout;
+    WaitPolicy wait;
+    int producers;         // Ranks 0..producers-1 produce, the rest consume
+    int priority_aqi;      // Threshold of the priority lane, -1 for no lane
+    int priority_size;     // Cells of the priority lane
+    int prefetch;          // Items each consumer claims ahead, 0 for none
+    bool steal;            // Idle consumers steal from other inboxes
+    char spill_file[256];  // File mode: where producers spill records, "" for none
+    int threads;           // Benchmark mode: worker threads per consumer rank, 0 for none;
+                           // threads mode: consumer threads, 0 for the default
 } ProgramConfig;
 
 // Print usage information
 void print_usage(char *program_name);
 
+// Name of a layout as spelled by --layout
+const char *layout_name(FFQLayout layout);
+
 // Parse command line arguments
 void parse_args(int argc, char **argv, ProgramConfig *config);
 
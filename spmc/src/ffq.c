@@ -4,227 +4,580 @@
 #include <unistd.h>
 #include <stddef.h>
 #include <string.h>
+#include <stdatomic.h>
+#include <limits.h>
+
+// View a queue field in a shared-memory window as a C11 atomic
+#define ATOMIC_INT(field) ((_Atomic int*)&(field))
+#define ATOMIC_STATE(field) ((_Atomic int64_t*)&(field))
 
 void do_work(int time_ms) {
     usleep(time_ms * 1000);
 }
 
-FFQueue* ffq_init(int size, MPI_Win* win, MPI_Comm comm) {
+// True when every rank of comm lives on the same node, so the queue can be
+// placed in a shared-memory window and accessed with plain loads/stores
+static bool all_ranks_share_node(MPI_Comm comm) {
+    int comm_size, node_size;
+    MPI_Comm node_comm;
+    
+    MPI_Comm_size(comm, &comm_size);
+    MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, 0, MPI_INFO_NULL, &node_comm);
+    MPI_Comm_size(node_comm, &node_size);
+    MPI_Comm_free(&node_comm);
+    
+    return node_size == comm_size;
+}
+
+// Create MPI datatype for WeatherRecord
+static MPI_Datatype create_weather_record_type() {
+    MPI_Datatype weather_type;
+    int blocklengths[] = {1, 1, 1, 1, 1, 1, 1};
+    MPI_Datatype types[] = {MPI_INT64_T, MPI_FLOAT, MPI_UINT16_T, MPI_UINT16_T, MPI_INT16_T, MPI_UINT8_T, MPI_UINT8_T};
+    MPI_Aint offsets[7];
+    
+    offsets[0] = offsetof(WeatherRecord, timestamp_us);
+    offsets[1] = offsetof(WeatherRecord, wind_speed);
+    offsets[2] = offsetof(WeatherRecord, city_id);
+    offsets[3] = offsetof(WeatherRecord, icon_id);
+    offsets[4] = offsetof(WeatherRecord, aqi);
+    offsets[5] = offsetof(WeatherRecord, humidity);
+    offsets[6] = offsetof(WeatherRecord, flags);
+    
+    MPI_Type_create_struct(7, blocklengths, offsets, types, &weather_type);
+    MPI_Type_commit(&weather_type);
+    
+    return weather_type;
+}
+
+// The baseline keeps every cell on rank 0 whatever the requested layout,
+// in a single ring of fixed size (no priority lane, no resizing)
+FFQHandle* ffq_init(int size, MPI_Comm comm, const FFQOptions* options) {
     int rank;
     MPI_Comm_rank(comm, &rank);
 
     FFQueue* queue = NULL;
+    MPI_Win win;
     
     // Calculate size needed for the window
-    MPI_Aint win_size = sizeof(FFQueue) + size * sizeof(Cell);
+    MPI_Aint win_size = FFQ_WINDOW_SIZE(size);
+    
+    // Use a shared-memory window when all ranks share a node,
+    // otherwise fall back to a regular RMA window. An attached queue goes
+    // into the caller's dynamic window, which is never shared.
+    bool attached = options->window != MPI_WIN_NULL;
+    bool shared = !attached && all_ranks_share_node(comm);
+    MPI_Aint base = 0;
     
     // Allocate the window
+    if (attached) {
+        // Only rank 0 holds memory, attached at an address others must learn
+        win = options->window;
+        if (rank == 0) {
+            size_t lines = (win_size + FFQ_CACHE_LINE - 1) / FFQ_CACHE_LINE;
+            queue = (FFQueue*)aligned_alloc(FFQ_CACHE_LINE, lines * FFQ_CACHE_LINE);
+            MPI_Win_attach(win, queue, win_size);
+            MPI_Get_address(queue, &base);
+        }
+        MPI_Bcast(&base, 1, MPI_AINT, 0, comm);
+    } else if (rank == 0) {
+        if (shared) {
+            MPI_Win_allocate_shared(win_size, 1, MPI_INFO_NULL, comm, &queue, &win);
+        } else {
+            MPI_Win_allocate(win_size, 1, MPI_INFO_NULL, comm, &queue, &win);
+        }
+    } else if (shared) {
+        // Only rank 0 allocates memory, others map its segment directly
+        MPI_Aint segment_size;
+        int disp_unit;
+        MPI_Win_allocate_shared(0, 1, MPI_INFO_NULL, comm, &queue, &win);
+        MPI_Win_shared_query(win, 0, &segment_size, &disp_unit, &queue);
+    } else {
+        // Only rank 0 allocates memory, others just create the window
+        MPI_Win_allocate(0, 1, MPI_INFO_NULL, comm, &queue, &win);
+    }
+    
     if (rank == 0) {
-        MPI_Win_allocate(win_size, 1, MPI_INFO_NULL, comm, &queue, win);
-        
         // Initialize queue
         queue->size = size;
         queue->head = 0;
         queue->tail = 0;
         queue->lastItemDequeued = 0;
+        queue->producerLock = 0;
+        queue->sleepers = 0;
+        queue->capacity = 0;
+        queue->resolved[0] = 0;
+        queue->resolved[1] = 0;
         
         // Initialize cells
         for (int i = 0; i < size; i++) {
-            queue->cells[i].rank = EMPTY_CELL;
-            queue->cells[i].gap = EMPTY_CELL;
-            memset(&(queue->cells[i].data), 0, sizeof(WeatherData));
-            queue->cells[i].data.valid = false;
+            queue->cells[i].state = FFQ_STATE(EMPTY_CELL, EMPTY_CELL);
+            queue->cells[i].lock = 0;
+            memset(FFQ_CELL_DATA(queue, i), 0, sizeof(WeatherRecord));
         }
-    } else {
-        // Only rank 0 allocates memory, others just create the window
-        MPI_Win_allocate(0, 1, MPI_INFO_NULL, comm, &queue, win);
+        
+        printf("Queue backend: %s\n", shared ? "shared memory" : "RMA");
     }
     
     // Ensure all processes see initialized data
     MPI_Barrier(comm);
     
-    return queue;
+    // Open one passive-target epoch for the lifetime of the queue. All
+    // accesses below are completed with MPI_Win_flush instead of lock/unlock.
+    // An attached queue uses the epoch of the window's owner.
+    if (!attached) {
+        MPI_Win_lock_all(0, win);
+    }
+    
+    // The handle owns the committed record datatype, built once here
+    // rather than on every enqueue and dequeue
+    FFQHandle* handle = (FFQHandle*)malloc(sizeof(FFQHandle));
+    handle->queue = queue;
+    handle->win = win;
+    handle->attached = attached;
+    handle->base = base;
+    handle->memory = attached ? queue : NULL;
+    handle->local_size = size; // Every rank passes the same size
+    handle->local_rank = rank;
+    handle->weather_type = create_weather_record_type();
+    handle->cell_state_type = MPI_DATATYPE_NULL;
+    handle->shared = shared;
+    handle->tail = 0;
+    handle->segment_size = size;
+    handle->first_host = 0;
+    handle->layout = FFQ_LAYOUT_CENTRAL;
+    handle->inboxes = 0;
+    handle->inbox = NULL;
+    handle->inbox_head = NULL;
+    handle->inbox_tail = NULL;
+    handle->comm = MPI_COMM_NULL;
+    handle->wait = options->wait;
+    handle->producers = options->producers;
+    handle->lane = NULL;
+    handle->priority_aqi = options->priority_aqi;
+    handle->pending = -1;
+    handle->doorbell = MPI_REQUEST_NULL;
+    handle->batch_first = 0;
+    handle->batch_count = 0;
+    handle->max_size = 0;
+    handle->min_size = size;
+    handle->capacity = 0;
+    handle->initialized = size;
+    handle->quiet = 0;
+    handle->steal = false;
+    handle->credit = -1;
+    handle->published = 0;
+    
+    return handle;
 }
 
-// Create MPI datatype for WeatherData
-static MPI_Datatype create_weather_data_type() {
-    MPI_Datatype weather_type;
-    int blocklengths[] = {MAX_TIMESTAMP_LEN, MAX_CITY_LEN, 1, MAX_ICON_LEN, 1, 1, 1};
-    MPI_Datatype types[] = {MPI_CHAR, MPI_CHAR, MPI_INT, MPI_CHAR, MPI_FLOAT, MPI_INT, MPI_C_BOOL};
-    MPI_Aint offsets[7];
+void ffq_publish_tail(FFQHandle* handle) {
+    if (handle->producers > 1) {
+        return; // Every enqueue already stored the tail
+    }
+    MPI_Accumulate(&handle->tail, 1, MPI_INT, 0, 
+                   FFQ_FIELD_DISP(handle, tail), 
+                   1, MPI_INT, MPI_REPLACE, handle->win);
+    MPI_Win_flush(0, handle->win);
+}
+
+void ffq_cleanup(FFQHandle* handle) {
+    if (handle) {
+        MPI_Type_free(&handle->weather_type);
+        if (handle->memory) {
+            MPI_Win_detach(handle->win, handle->memory);
+            free(handle->memory);
+        } else if (!handle->attached) {
+            MPI_Win_unlock_all(handle->win);
+            MPI_Win_free(&handle->win);
+        }
+        free(handle);
+    }
+}
+
+// Shared-memory enqueue: same algorithm, cells accessed in place.
+// The release XOR of the state word publishes the data written before it.
+static bool ffq_enqueue_shared(FFQHandle* handle, WeatherRecord item) {
+    FFQueue* queue = handle->queue;
+    bool success = false;
+    int local_tail = handle->tail;
     
-    offsets[0] = offsetof(WeatherData, timestamp);
-    offsets[1] = offsetof(WeatherData, city);
-    offsets[2] = offsetof(WeatherData, aqi);
-    offsets[3] = offsetof(WeatherData, weather_icon);
-    offsets[4] = offsetof(WeatherData, wind_speed);
-    offsets[5] = offsetof(WeatherData, humidity);
-    offsets[6] = offsetof(WeatherData, valid);
+    Waiter waiter;
+    waiter_init(&waiter, &handle->wait);
     
-    MPI_Type_create_struct(7, blocklengths, offsets, types, &weather_type);
-    MPI_Type_commit(&weather_type);
+    while (!success) {
+        int idx = local_tail % queue->size;
+        _Atomic int64_t* state_word = ATOMIC_STATE(queue->cells[idx].state);
+        int64_t state = atomic_load_explicit(state_word, memory_order_acquire);
+        
+        if (FFQ_STATE_RANK(state) < 0) {
+            // Cell is free, write data then publish the rank
+            *FFQ_CELL_DATA(queue, idx) = item;
+            atomic_fetch_xor_explicit(state_word, FFQ_RANK_FLIP(EMPTY_CELL, local_tail), 
+                                      memory_order_release);
+            
+            success = true;
+            printf("Producer enqueued item for city %u at cell %d (rank %d)\n", 
+                   item.city_id, idx, local_tail);
+        } else {
+            // Cell is in use, mark as gap
+            atomic_fetch_xor_explicit(state_word, FFQ_GAP_FLIP(FFQ_STATE_GAP(state), local_tail), 
+                                      memory_order_release);
+            
+            printf("Producer skipped cell %d (rank %d)\n", idx, local_tail);
+        }
+        
+        local_tail++;
+        
+        if (!success) {
+            waiter_pause(&waiter);
+        }
+    }
     
-    return weather_type;
+    handle->tail = local_tail;
+    return success;
 }
 
-bool ffq_enqueue(FFQueue* queue, WeatherData item, MPI_Win win) {
+// Shared-memory dequeue: head is claimed with atomic_fetch_add and the
+// cell is recycled with a release XOR after the data has been copied.
+// Without wait, a rank the producer has not written yet is kept pending.
+static bool ffq_dequeue_shared(FFQHandle* handle, int consumer_id, WeatherRecord* item, bool wait) {
+    FFQueue* queue = handle->queue;
+    int fetch_rank = handle->pending;
+    if (fetch_rank < 0) {
+        fetch_rank = atomic_fetch_add_explicit(ATOMIC_INT(queue->head), 1, memory_order_relaxed);
+    }
+    handle->pending = -1;
+    int idx = fetch_rank % queue->size;
     bool success = false;
-    int local_tail = queue->tail; // Cache the tail value
-    MPI_Datatype weather_type = create_weather_data_type();
+    
+    Waiter waiter;
+    waiter_init(&waiter, &handle->wait);
     
     while (!success) {
-        MPI_Win_lock(MPI_LOCK_EXCLUSIVE, 0, 0, win);
+        _Atomic int64_t* state_word = ATOMIC_STATE(queue->cells[idx].state);
+        int64_t state = atomic_load_explicit(state_word, memory_order_acquire);
+        int cell_rank = FFQ_STATE_RANK(state);
+        int cell_gap = FFQ_STATE_GAP(state);
         
-        int idx = local_tail % queue->size;
+        if (cell_rank == fetch_rank) {
+            // Item found, copy it out before recycling the cell
+            *item = *FFQ_CELL_DATA(queue, idx);
+            atomic_fetch_xor_explicit(state_word, FFQ_RANK_FLIP(fetch_rank, EMPTY_CELL), 
+                                      memory_order_release);
+            atomic_fetch_add_explicit(ATOMIC_INT(queue->lastItemDequeued), 1, memory_order_relaxed);
+            
+            success = true;
+            printf("Consumer %d dequeued item for (timestamp %lld, city %u, aqi %d, wind_speed %f, humidity %u) from cell %d (rank %d)\n", 
+                   consumer_id, (long long)item->timestamp_us, item->city_id, item->aqi, item->wind_speed, item->humidity, idx, fetch_rank);
+        } 
+        else if (cell_gap >= fetch_rank && cell_rank != fetch_rank) {
+            // Cell was skipped, move to next rank
+            fetch_rank = atomic_fetch_add_explicit(ATOMIC_INT(queue->head), 1, memory_order_relaxed);
+            idx = fetch_rank % queue->size;
+            printf("Consumer %d skipped to rank %d (cell %d)\n", 
+                   consumer_id, fetch_rank, idx);
+        } 
+        else if (!wait) {
+            handle->pending = fetch_rank;
+            break;
+        }
+        else {
+            // Producer is still writing the cell
+            waiter_pause(&waiter);
+        }
+    }
+    
+    return success;
+}
+
+static bool ffq_enqueue_spmc(FFQHandle* handle, WeatherRecord item) {
+    if (handle->shared) {
+        return ffq_enqueue_shared(handle, item);
+    }
+    
+    MPI_Win win = handle->win;
+    bool success = false;
+    int local_tail = handle->tail; // The tail is producer-local
+    MPI_Datatype weather_type = handle->weather_type;
+    
+    Waiter waiter;
+    waiter_init(&waiter, &handle->wait);
+    
+    while (!success) {
+        int idx = local_tail % handle->local_size;
         
-        // Read the cell's rank value
-        int cell_rank;
-        MPI_Get(&cell_rank, 1, MPI_INT, 0, 
-                offsetof(FFQueue, cells[idx].rank), 
-                1, MPI_INT, win);
+        // Atomically read the cell's state (rank and gap)
+        int64_t state;
+        MPI_Fetch_and_op(NULL, &state, MPI_INT64_T, 0, 
+                         FFQ_FIELD_DISP(handle, cells[idx].state), 
+                         MPI_NO_OP, win);
         MPI_Win_flush(0, win);
         
-        if (cell_rank < 0) {
+        if (FFQ_STATE_RANK(state) < 0) {
             // Cell is free, write data first
             MPI_Put(&item, 1, weather_type, 0, 
-                    offsetof(FFQueue, cells[idx].data), 
+                    handle->base + FFQ_DATA_DISP(handle->local_size, idx), 
                     1, weather_type, win);
             MPI_Win_flush(0, win);
             
-            // Then update the rank to mark as used
-            MPI_Put(&local_tail, 1, MPI_INT, 0, 
-                    offsetof(FFQueue, cells[idx].rank), 
-                    1, MPI_INT, win);
+            // Then update the rank to mark as used, keeping the gap
+            int64_t used = FFQ_RANK_FLIP(EMPTY_CELL, local_tail);
+            MPI_Accumulate(&used, 1, MPI_INT64_T, 0, 
+                           FFQ_FIELD_DISP(handle, cells[idx].state), 
+                           1, MPI_INT64_T, MPI_BXOR, win);
             MPI_Win_flush(0, win);
             
             success = true;
-            printf("Producer enqueued item for city %s at cell %d (rank %d)\n", 
-                   item.city, idx, local_tail);
+            printf("Producer enqueued item for city %u at cell %d (rank %d)\n", 
+                   item.city_id, idx, local_tail);
         } else {
-            // Cell is in use, mark as gap
-            MPI_Put(&local_tail, 1, MPI_INT, 0, 
-                    offsetof(FFQueue, cells[idx].gap), 
-                    1, MPI_INT, win);
+            // Cell is in use, mark as gap, keeping the rank
+            int64_t skipped = FFQ_GAP_FLIP(FFQ_STATE_GAP(state), local_tail);
+            MPI_Accumulate(&skipped, 1, MPI_INT64_T, 0, 
+                           FFQ_FIELD_DISP(handle, cells[idx].state), 
+                           1, MPI_INT64_T, MPI_BXOR, win);
             MPI_Win_flush(0, win);
             
             printf("Producer skipped cell %d (rank %d)\n", idx, local_tail);
         }
         
-        // Update tail
         local_tail++;
-        MPI_Put(&local_tail, 1, MPI_INT, 0, 
-                offsetof(FFQueue, tail), 
-                1, MPI_INT, win);
-        MPI_Win_flush(0, win);
-        
-        MPI_Win_unlock(0, win);
         
         if (!success) {
-            do_work(10); // Small backoff
+            waiter_pause(&waiter);
         }
     }
     
-    MPI_Type_free(&weather_type);
+    handle->tail = local_tail;
     return success;
 }
 
-bool ffq_dequeue(FFQueue* queue, int consumer_id, WeatherData* item, MPI_Win win) {
-    int fetch_rank = 0;
-    MPI_Datatype weather_type = create_weather_data_type();
+// Several producers take turns: the one holding the header's lock word
+// loads the shared tail into its handle, runs the single-producer enqueue
+// and stores the tail back before releasing the lock
+static void lock_producers(FFQHandle* handle) {
+    Waiter waiter;
+    waiter_init(&waiter, &handle->wait);
     
-    // Atomically fetch and increment the head
-    MPI_Win_lock(MPI_LOCK_EXCLUSIVE, 0, 0, win);
+    if (handle->shared) {
+        FFQueue* queue = handle->queue;
+        int unlocked = 0;
+        while (!atomic_compare_exchange_weak_explicit(ATOMIC_INT(queue->producerLock), &unlocked, 1,
+                                                      memory_order_acquire, memory_order_relaxed)) {
+            unlocked = 0;
+            waiter_pause(&waiter);
+        }
+        handle->tail = atomic_load_explicit(ATOMIC_INT(queue->tail), memory_order_relaxed);
+        return;
+    }
     
-    // Get current head value
-    MPI_Get_accumulate(&(int){1}, 1, MPI_INT, 
-                      &fetch_rank, 1, MPI_INT, 
-                      0, offsetof(FFQueue, head), 1, 
-                      MPI_INT, MPI_SUM, win);
-    MPI_Win_flush(0, win);
-    MPI_Win_unlock(0, win);
+    const int locked = 1, unlocked = 0;
+    int previous = locked;
+    while (true) {
+        MPI_Compare_and_swap(&locked, &unlocked, &previous, MPI_INT, 0,
+                             FFQ_FIELD_DISP(handle, producerLock), handle->win);
+        MPI_Win_flush(0, handle->win);
+        if (previous == unlocked) {
+            break;
+        }
+        waiter_pause(&waiter);
+    }
+    MPI_Fetch_and_op(NULL, &handle->tail, MPI_INT, 0,
+                     FFQ_FIELD_DISP(handle, tail), MPI_NO_OP, handle->win);
+    MPI_Win_flush(0, handle->win);
+}
+
+static void unlock_producers(FFQHandle* handle) {
+    if (handle->shared) {
+        FFQueue* queue = handle->queue;
+        atomic_store_explicit(ATOMIC_INT(queue->tail), handle->tail, memory_order_relaxed);
+        atomic_store_explicit(ATOMIC_INT(queue->producerLock), 0, memory_order_release);
+        return;
+    }
+    
+    const int unlocked = 0;
+    MPI_Accumulate(&handle->tail, 1, MPI_INT, 0, 
+                   FFQ_FIELD_DISP(handle, tail), 
+                   1, MPI_INT, MPI_REPLACE, handle->win);
+    MPI_Win_flush(0, handle->win);
+    MPI_Accumulate(&unlocked, 1, MPI_INT, 0, 
+                   FFQ_FIELD_DISP(handle, producerLock), 
+                   1, MPI_INT, MPI_REPLACE, handle->win);
+    MPI_Win_flush(0, handle->win);
+}
+
+bool ffq_enqueue(FFQHandle* handle, WeatherRecord item) {
+    if (handle->producers == 1) {
+        return ffq_enqueue_spmc(handle, item);
+    }
+    
+    lock_producers(handle);
+    bool success = ffq_enqueue_spmc(handle, item);
+    unlock_producers(handle);
+    return success;
+}
+
+// The baseline ring keeps the size it was created with
+bool ffq_resize(FFQHandle* handle, int size) {
+    (void)handle;
+    (void)size;
+    return false;
+}
+
+// The baseline tracks no credit: its producer skips busy cells instead
+int ffq_credit(FFQHandle* handle) {
+    (void)handle;
+    return INT_MAX;
+}
+
+// The baseline enqueues a batch one item at a time
+int ffq_enqueue_batch(FFQHandle* handle, const WeatherRecord* items, int n) {
+    int count = 0;
+    for (int i = 0; i < n; i++) {
+        if (ffq_enqueue(handle, items[i])) {
+            count++;
+        }
+    }
+    return count;
+}
+
+// The baseline claims one rank per call
+int ffq_dequeue_batch(FFQHandle* handle, int consumer_id, WeatherRecord* out, int max) {
+    if (max <= 0) {
+        return 0;
+    }
+    return ffq_dequeue(handle, consumer_id, &out[0]) ? 1 : 0;
+}
+
+// Dequeue one item. Without wait, returns false instead of waiting for the
+// producer and keeps the claimed rank for the next call.
+static bool dequeue(FFQHandle* handle, int consumer_id, WeatherRecord* item, bool wait) {
+    if (handle->shared) {
+        return ffq_dequeue_shared(handle, consumer_id, item, wait);
+    }
+    
+    MPI_Win win = handle->win;
+    int fetch_rank = handle->pending;
+    const int one = 1;
+    MPI_Datatype weather_type = handle->weather_type;
+    
+    // Atomically fetch and increment the head (one round trip, no lock)
+    if (fetch_rank < 0) {
+        MPI_Fetch_and_op(&one, &fetch_rank, MPI_INT, 0, 
+                         FFQ_FIELD_DISP(handle, head), MPI_SUM, win);
+        MPI_Win_flush(0, win);
+    }
+    handle->pending = -1;
     
     int local_size = 0;
-    MPI_Win_lock(MPI_LOCK_SHARED, 0, 0, win);
-    MPI_Get(&local_size, 1, MPI_INT, 0, offsetof(FFQueue, size), 1, MPI_INT, win);
+    MPI_Get(&local_size, 1, MPI_INT, 0, FFQ_FIELD_DISP(handle, size), 1, MPI_INT, win);
     MPI_Win_flush(0, win);
-    MPI_Win_unlock(0, win);
     
     int idx = fetch_rank % local_size;
     bool success = false;
     
+    Waiter waiter;
+    waiter_init(&waiter, &handle->wait);
+    
     while (!success) {
-        MPI_Win_lock(MPI_LOCK_SHARED, 0, 0, win);
-        
-        // Read cell values
-        int cell_rank, cell_gap;
-        WeatherData cell_data;
-        MPI_Get(&cell_rank, 1, MPI_INT, 0, 
-                offsetof(FFQueue, cells[idx].rank), 
-                1, MPI_INT, win);
-        MPI_Get(&cell_gap, 1, MPI_INT, 0, 
-                offsetof(FFQueue, cells[idx].gap), 
-                1, MPI_INT, win);
-        MPI_Get(&cell_data, 1, weather_type, 0, 
-                offsetof(FFQueue, cells[idx].data), 
-                1, weather_type, win);
-        MPI_Win_flush(0, win);
-        
-        // Check if item has been dequeued already
-        int lastItem;
-        MPI_Get(&lastItem, 1, MPI_INT, 0, 
-                offsetof(FFQueue, lastItemDequeued), 
-                1, MPI_INT, win);
+        // Read cell metadata atomically. The payload is only read once the
+        // rank matches, since the producer publishes the rank after the data.
+        int64_t state;
+        MPI_Fetch_and_op(NULL, &state, MPI_INT64_T, 0, 
+                         FFQ_FIELD_DISP(handle, cells[idx].state), 
+                         MPI_NO_OP, win);
         MPI_Win_flush(0, win);
-        MPI_Win_unlock(0, win);
+        int cell_rank = FFQ_STATE_RANK(state);
+        int cell_gap = FFQ_STATE_GAP(state);
         
         if (cell_rank == fetch_rank) {
             // Item found, dequeue it
-            *item = cell_data;
-            
-            MPI_Win_lock(MPI_LOCK_EXCLUSIVE, 0, 0, win);
-            
-            // Mark cell as empty
-            int empty = EMPTY_CELL;
-            MPI_Put(&empty, 1, MPI_INT, 0, 
-                    offsetof(FFQueue, cells[idx].rank), 
-                    1, MPI_INT, win);
+            MPI_Get(item, 1, weather_type, 0, 
+                    handle->base + FFQ_DATA_DISP(local_size, idx), 
+                    1, weather_type, win);
             MPI_Win_flush(0, win);
             
+            // Mark cell as empty, keeping the gap
+            int64_t empty = FFQ_RANK_FLIP(fetch_rank, EMPTY_CELL);
+            MPI_Accumulate(&empty, 1, MPI_INT64_T, 0, 
+                           FFQ_FIELD_DISP(handle, cells[idx].state), 
+                           1, MPI_INT64_T, MPI_BXOR, win);
+            
             // Update dequeue counter
-            int new_last = lastItem + 1;
-            MPI_Put(&new_last, 1, MPI_INT, 0, 
-                    offsetof(FFQueue, lastItemDequeued), 
-                    1, MPI_INT, win);
+            MPI_Accumulate(&one, 1, MPI_INT, 0, 
+                           FFQ_FIELD_DISP(handle, lastItemDequeued), 
+                           1, MPI_INT, MPI_SUM, win);
             MPI_Win_flush(0, win);
             
-            MPI_Win_unlock(0, win);
-            
             success = true;
-            printf("Consumer %d dequeued item for (timestamp %s, city %s, aqi %d, wind_speed %f, humidity %d) from cell %d (rank %d)\n", 
-                   consumer_id, item->timestamp, item->city, item->aqi, item->wind_speed, item->humidity, idx, fetch_rank);
+            printf("Consumer %d dequeued item for (timestamp %lld, city %u, aqi %d, wind_speed %f, humidity %u) from cell %d (rank %d)\n", 
+                   consumer_id, (long long)item->timestamp_us, item->city_id, item->aqi, item->wind_speed, item->humidity, idx, fetch_rank);
         } 
         else if (cell_gap >= fetch_rank && cell_rank != fetch_rank) {
-            // Cell was skipped, move to next rank
-            MPI_Win_lock(MPI_LOCK_EXCLUSIVE, 0, 0, win);
-            
-            // Atomically get the next rank
-            MPI_Get_accumulate(&(int){1}, 1, MPI_INT, 
-                              &fetch_rank, 1, MPI_INT, 
-                              0, offsetof(FFQueue, head), 1, 
-                              MPI_INT, MPI_SUM, win);
+            // Cell was skipped, atomically get the next rank
+            MPI_Fetch_and_op(&one, &fetch_rank, MPI_INT, 0, 
+                             FFQ_FIELD_DISP(handle, head), MPI_SUM, win);
             MPI_Win_flush(0, win);
-            MPI_Win_unlock(0, win);
             
             idx = fetch_rank % local_size;
             printf("Consumer %d skipped to rank %d (cell %d)\n", 
                    consumer_id, fetch_rank, idx);
         } 
+        else if (!wait) {
+            handle->pending = fetch_rank;
+            break;
+        }
         else {
             // Wait for producer to write data
-            do_work(10);
+            waiter_pause(&waiter);
         }
     }
     
-    MPI_Type_free(&weather_type);
     return success;
+}
+
+bool ffq_dequeue(FFQHandle* handle, int consumer_id, WeatherRecord* item) {
+    return dequeue(handle, consumer_id, item, true);
+}
+
+bool ffq_try_dequeue(FFQHandle* handle, int consumer_id, WeatherRecord* item) {
+    return dequeue(handle, consumer_id, item, false);
+}
+
+// The baseline has no request-based RMA: an enqueue request completes when
+// it starts, a dequeue request is a try-dequeue per test
+void ffq_ienqueue(FFQHandle* handle, WeatherRecord item, FFQRequest* request) {
+    request->handle = handle;
+    request->rma = MPI_REQUEST_NULL;
+    request->consumer_id = -1;
+    request->item = item;
+    request->out = NULL;
+    request->success = ffq_enqueue(handle, item);
+    request->done = true;
+}
+
+void ffq_idequeue(FFQHandle* handle, int consumer_id, WeatherRecord* item, FFQRequest* request) {
+    request->handle = handle;
+    request->rma = MPI_REQUEST_NULL;
+    request->consumer_id = consumer_id;
+    request->out = item;
+    request->success = false;
+    request->done = false;
+}
+
+bool ffq_test(FFQRequest* request) {
+    if (!request->done && ffq_try_dequeue(request->handle, request->consumer_id, request->out)) {
+        request->success = true;
+        request->done = true;
+    }
+    return request->done;
+}
+
+bool ffq_wait(FFQRequest* request) {
+    if (!request->done) {
+        request->success = ffq_dequeue(request->handle, request->consumer_id, request->out);
+        request->done = true;
+    }
+    return request->success;
 }
\ No newline at end of file
@@ -2,37 +2,289 @@
 #define FFQ_H
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <mpi.h>
-#include "weather_data.h"
+#include "weather_record.h"
+#include "wait_policy.h"
 
 #define EMPTY_CELL -1
+#define CLAIMED_CELL -2 // Rank of a cell an MPMC producer is writing
+#define FFQ_CACHE_LINE 64
+#define ENQUEUE_BATCH_SIZE 16 // Max records handed to ffq_enqueue_batch at once (larger
+                              // batches are written ENQUEUE_BATCH_SIZE cells at a time)
+#define DEQUEUE_BATCH_SIZE 8  // Max ranks claimed by one ffq_dequeue_batch
 
+// Cell metadata only. Payloads live in a separate array after the metadata
+// so polling consumers touch one cache line per cell, and each cell gets its
+// own line so publishing one never invalidates a neighbour being polled.
+// Rank and gap are packed into one 64-bit state word (rank in the high half)
+// so both are read with one atomic. Each half has a single writer at a time
+// (the producer sets ranks and gaps, the claiming consumer clears its rank),
+// so updates are atomic XORs confined to one half and never need a retry.
+// With several producers (MPMC) a producer first claims the cell: with a
+// compare-and-swap of the state word in shared memory, or by taking the
+// cell's 32-bit lock over RMA (see ffq_optimized.c for why not a CAS).
 typedef struct
 {
-    int rank;
-    int gap;
-    WeatherData data;
+    _Alignas(FFQ_CACHE_LINE) int64_t state;
+    int32_t lock; // 1 while an MPMC producer holds the cell (RMA only)
 } Cell;
 
+#define FFQ_STATE(rank, gap) \
+    ((int64_t)(((uint64_t)(uint32_t)(rank) << 32) | (uint32_t)(gap)))
+#define FFQ_STATE_RANK(state) ((int)(int32_t)((uint64_t)(state) >> 32))
+#define FFQ_STATE_GAP(state) ((int)(int32_t)(uint32_t)(uint64_t)(state))
+
+// XOR operands turning a known rank (or gap) value from into to
+#define FFQ_RANK_FLIP(from, to) FFQ_STATE((from) ^ (to), 0)
+#define FFQ_GAP_FLIP(from, to) FFQ_STATE(0, (from) ^ (to))
+
+// Window layout: this header, cells[size], then WeatherRecord payloads[size]
 typedef struct
 {
-    int size;
+    int size;              // Cells laid out (all reserved ones when resizable)
     int head;
-    int tail;
+    int tail;              // Snapshot written by ffq_publish_tail (SPMC),
+                           // next rank to claim (MPMC)
     int lastItemDequeued;
+    int producerLock;      // Baseline MPMC: 1 while a producer enqueues
+    int64_t sleepers;      // Consumers blocked for a publish, one bit per rank
+    int64_t capacity;      // Resizable queues: sizes in use and where they
+                           // switch (see ffq_optimized.c)
+    int resolved[2];       // Resizable queues: ranks taken or skipped per
+                           // capacity generation (by parity)
     Cell cells[];
 } FFQueue;
 
-// Initialization function
-FFQueue *ffq_init(int size, MPI_Win *win, MPI_Comm comm);
+// Window displacement of the payload of cell idx
+#define FFQ_DATA_DISP(size, idx) \
+    ((MPI_Aint)(sizeof(FFQueue) + (size_t)(size) * sizeof(Cell) + (size_t)(idx) * sizeof(WeatherRecord)))
+
+// Local address of the payload of cell idx (rank 0, or any rank when shared)
+#define FFQ_CELL_DATA(queue, idx) \
+    ((WeatherRecord *)((char *)(queue) + FFQ_DATA_DISP((queue)->size, idx)))
+
+// Bytes needed for a queue of the given size
+#define FFQ_WINDOW_SIZE(size) FFQ_DATA_DISP(size, size)
+
+// Bytes rounded up to whole cache lines
+#define FFQ_ALIGN_UP(bytes) \
+    (((MPI_Aint)(bytes) + FFQ_CACHE_LINE - 1) / FFQ_CACHE_LINE * FFQ_CACHE_LINE)
+
+// Window layout of a consumer's inbox (inbox layout): a single-producer
+// single-consumer ring whose indices count items and sit on their own lines
+typedef struct
+{
+    _Alignas(FFQ_CACHE_LINE) int tail; // Items delivered, written by the producer
+    _Alignas(FFQ_CACHE_LINE) int head; // Items consumed, written by the owner
+                                       // (and by thieves when stealing)
+    _Alignas(FFQ_CACHE_LINE) WeatherRecord items[];
+} FFQInbox;
+
+// Bytes needed for an inbox of the given capacity
+#define FFQ_INBOX_SIZE(capacity) \
+    ((MPI_Aint)(sizeof(FFQInbox) + (size_t)(capacity) * sizeof(WeatherRecord)))
+
+// Where the cells of the ring live. Head, tail and counters always stay
+// in rank 0's window header.
+typedef enum
+{
+    FFQ_LAYOUT_CENTRAL, // All cells on rank 0
+    FFQ_LAYOUT_SHARDED, // Cells split in contiguous segments over ranks 1..P-1
+    FFQ_LAYOUT_INBOX    // Producer pushes into one FFQInbox per consumer rank;
+                        // consumers only read local memory and never update
+                        // rank 0's header (lastItemDequeued stays untouched)
+} FFQLayout;
+
+// Options of ffq_init
+typedef struct
+{
+    FFQLayout layout;
+    WaitPolicy wait;  // How every retry loop of the queue waits
+    int producers;    // Ranks 0..producers-1 enqueue; more than one means MPMC
+    MPI_Win window;   // Dynamic window to attach the queue to (see
+                      // ffq_registry.h), MPI_WIN_NULL for a window of its own
+    int priority_size; // Cells of the priority lane, 0 for none
+    int priority_aqi;  // Records with at least this AQI take the priority lane
+    int max_size;      // Cells a resizable ring may grow to, 0 for a fixed size
+    bool steal;        // Inbox layout: idle consumers take work from other inboxes
+} FFQOptions;
+
+// Queue handle shared by both backends (ffq.c and ffq_optimized.c).
+// Each binary links exactly one of them behind this interface.
+typedef struct FFQHandle
+{
+    FFQueue *queue;            // Valid on rank 0, or on every rank when shared
+    MPI_Win win;
+    bool attached;             // Queue lives in a dynamic window it does not own
+    MPI_Aint base;             // Window address of the queue on rank 0 (0 unless attached)
+    void *memory;              // Rank 0's queue memory when attached, NULL otherwise
+    int local_size;            // Cached ring size (the producer's current one when resizable)
+    int local_rank;            // Process rank
+    int tail;                  // Producer-local tail (see ffq_publish_tail)
+    int producers;             // Enqueuing ranks (0..producers-1)
+    int segment_size;          // Cells hosted per rank (local_size when central)
+    int first_host;            // Rank hosting cell 0 (0 when central)
+    FFQLayout layout;
+    int inboxes;               // Consumer inboxes (inbox layout)
+    FFQInbox *inbox;           // Own inbox (inbox layout, consumers only)
+    int *inbox_head;           // Producer's last view of each inbox head
+    int *inbox_tail;           // Producer's scratch for new inbox tails
+    MPI_Comm comm;             // Private duplicate carrying wakeup messages
+    MPI_Request doorbell;      // Posted wakeup receive, MPI_REQUEST_NULL if none
+    WaitPolicy wait;           // How every retry loop of the queue waits
+    MPI_Datatype weather_type; // Committed WeatherRecord datatype
+    MPI_Datatype cell_state_type; // MPI_INT64_T strided by sizeof(Cell)
+    bool shared;               // Queue lives in a shared-memory window
+    struct FFQHandle *lane;    // Priority lane next to this ring, NULL if none
+    int priority_aqi;          // Routing threshold of the lane
+    int pending;               // Rank claimed but not taken yet (left for a lane
+                               // item or by a try-dequeue), -1 if none
+    int batch_first;           // First rank of the run ffq_dequeue_batch claimed
+    int batch_count;           // and has not resolved yet, 0 if none
+    bool batch_done[DEQUEUE_BATCH_SIZE]; // Ranks of that run taken or skipped
+    int max_size;              // Cells reserved for a resizable ring, 0 if fixed
+    int min_size;              // Size automatic shrinking stops at (resizable)
+    int64_t capacity;          // Last capacity word seen (resizable)
+    int initialized;           // Producer: cells set up so far (resizable)
+    int quiet;                 // Producer: enqueues since the last resize check
+    bool steal;                // Consumers steal from other inboxes (inbox layout)
+    int credit;                // Producer: free cells as last counted, -1 if
+                               // the ring does not track them (see ffq_credit)
+    int published;             // Producer: items enqueued so far (credit tracking)
+} FFQHandle;
+
+// Window displacement of a field of the queue (header or cell metadata, on rank 0)
+#define FFQ_FIELD_DISP(handle, field) \
+    ((handle)->base + (MPI_Aint)offsetof(FFQueue, field))
+
+// Initialization function (opens a lock_all epoch on the window).
+// When all ranks share a node the queue is placed in a shared-memory window
+// and handle->queue is valid on every rank; otherwise only on rank 0.
+// A sharded layout always uses RMA and spreads the cells over the
+// consumer ranks, so no single rank serves every cell access. The inbox
+// layout splits the capacity into per-consumer rings filled round-robin.
+// Retry loops wait according to options->wait (see wait_policy.h). With
+// several producers every enqueue claims its rank from the shared tail;
+// the inbox layout supports a single producer only. A queue attached to
+// options->window is always central and accessed through RMA, within the
+// epoch its owner keeps open on that window.
+// With options->priority_size cells, a priority lane (a second, central
+// ring) follows the queue in rank 0's window: records with an AQI of at
+// least options->priority_aqi are enqueued there, and consumers take lane
+// items ahead of the ring's backlog (see ffq_dequeue). A record that
+// finds the lane full goes through the ring instead.
+// With options->max_size above size, a central single-producer ring is
+// resizable: the window reserves max_size cells and the ring starts at
+// size (see ffq_resize). Other configurations keep a fixed size.
+// With options->steal, a consumer of the inbox layout whose inbox is empty
+// takes up to half the backlog of the fullest other inbox. Records marked
+// WEATHER_RECORD_SENTINEL are never stolen, so every consumer still
+// receives the sentinels dealt to its inbox. Ignored by other layouts.
+// A fixed-size ring with one producer (central or sharded) tracks credit:
+// when every cell holds an item not yet dequeued, enqueues wait for a
+// consumer to free one rather than marking busy cells as gaps.
+FFQHandle *ffq_init(int size, MPI_Comm comm, const FFQOptions *options);
+
+// Close the epoch opened by ffq_init, free the window and the handle.
+// An attached queue is detached instead, leaving the window open.
+void ffq_cleanup(FFQHandle *handle);
+
+// Copy the producer's private tail into the window so other ranks can
+// observe it (e.g. for monitoring). Enqueues never publish it themselves.
+// Does nothing with several producers, whose tail lives in the window.
+void ffq_publish_tail(FFQHandle *handle);
+
+// Enqueue function (for producer). Waits while the ring has no credit.
+bool ffq_enqueue(FFQHandle *handle, WeatherRecord item);
+
+// Cells the producer can fill before enqueues wait for consumers (for
+// producer), e.g. to hold back reading input or divert it while the
+// queue is full. The count is cached and only read back from the queue
+// once it runs out, so polling it is cheap. Queues without credit
+// tracking (see ffq_init, and the baseline) report INT_MAX: their
+// enqueues never wait for credit.
+int ffq_credit(FFQHandle *handle);
+
+// Enqueue n items in rank order (for producer). Runs of free cells are
+// written with one contiguous Put and published together. Returns the number enqueued.
+int ffq_enqueue_batch(FFQHandle *handle, const WeatherRecord *items, int n);
+
+// Change the capacity of a resizable ring (producer only). Sizes are
+// max_size halved k times, size is rounded up to one of them. Ranks from
+// the producer's tail on use the new size; items already enqueued stay
+// where they are. The producer also resizes on its own: it doubles the
+// ring after enqueues that had to skip cells and halves it (not below
+// the initial size) when the ring stays at most a quarter full.
+// Returns false if the queue is not resizable or the change before last
+// still has ranks in flight, so the capacity cannot change yet.
+bool ffq_resize(FFQHandle *handle, int size);
+
+// Dequeue function (for consumers). With a priority lane, a lane item is
+// returned before the claimed rank of the ring is taken, including while
+// waiting for it; the claim is then kept for the next call. The optimized
+// backend returns false if the claimed rank stays unwritten for 10 s, also
+// keeping the claim.
+bool ffq_dequeue(FFQHandle *handle, int consumer_id, WeatherRecord *item);
+
+// Dequeue up to max items (for consumers). Claims a run of up to
+// DEQUEUE_BATCH_SIZE consecutive ranks at once and returns, in rank order,
+// as soon as at least one of them holds an item. Ranks still unwritten are
+// kept in the handle and resumed by the next call, so none is lost; ranks
+// the producer skipped yield nothing. Every claimed rank is consumed, so do
+// not mix with one-per-consumer sentinels (a batch could swallow another
+// consumer's sentinel).
+// Priority lane items are only looked for before the ranks are claimed.
+// A resizable ring returns one item per call (a batch could straddle a
+// change of capacity).
+int ffq_dequeue_batch(FFQHandle *handle, int consumer_id, WeatherRecord *out, int max);
+
+// Dequeue an item if one is ready, without waiting (for consumers).
+// Returns false if the producer has not written the claimed rank yet; the
+// claim is then kept for the next dequeue, so no item is lost or reordered.
+bool ffq_try_dequeue(FFQHandle *handle, int consumer_id, WeatherRecord *item);
+
+// An enqueue or dequeue in progress (see ffq_ienqueue, ffq_idequeue). Its
+// RMA operations write into the request, so it must stay in place and
+// must not be reused until complete.
+typedef struct
+{
+    FFQHandle *handle;
+    MPI_Request rma;     // RMA operation in flight, MPI_REQUEST_NULL if none
+    int step;            // What the operation in flight is for (backend specific)
+    int consumer_id;
+    int rank;            // Rank claimed (dequeue) or written (enqueue)
+    int64_t state;       // State word of the rank's cell as last read
+    WeatherRecord item;  // Copy of the item to enqueue
+    WeatherRecord *out;  // Where the dequeued item is stored
+    bool done;
+    bool success;        // Item enqueued or dequeued, valid once done
+} FFQRequest;
+
+// Start enqueuing item (for producer); ffq_test or ffq_wait completes it.
+// Complete it before the next enqueue of any kind. Waits for credit
+// before starting.
+void ffq_ienqueue(FFQHandle *handle, WeatherRecord item, FFQRequest *request);
+
+// Start dequeuing into *item (for consumers), valid once the request
+// completes with success. Each request claims its own rank, so several may
+// be outstanding and blocking dequeues may be mixed in. Priority lane items
+// are only looked for when the request starts.
+// Requests overlap their RMA round trips with the caller's work on a
+// fixed-size ring accessed through RMA with one producer; otherwise an
+// enqueue completes at once and a dequeue tries once per ffq_test.
+void ffq_idequeue(FFQHandle *handle, int consumer_id, WeatherRecord *item, FFQRequest *request);
 
-// Enqueue function (for producer)
-bool ffq_enqueue(FFQueue *queue, WeatherData item, MPI_Win win);
+// Advance request as far as its completed RMA operations allow, without
+// waiting. Returns true once the request is done.
+bool ffq_test(FFQRequest *request);
 
-// Dequeue function (for consumers)
-bool ffq_dequeue(FFQueue *queue, int consumer_id, WeatherData *item, MPI_Win win);
+// Complete request. Returns whether the item was enqueued or dequeued
+// (a dequeue times out as ffq_dequeue does).
+bool ffq_wait(FFQRequest *request);
 
 // Simulated work function
 void do_work(int time_ms);
 
-#endif
\ No newline at end of file
+#endif
@@ -1,64 +1,346 @@
-#include "ffq_optimized.h"
+#include "ffq.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <stddef.h>
 #include <string.h>
+#include <stdatomic.h>
+#include <limits.h>
+#include <float.h>
+
+// View a queue field in a shared-memory window as a C11 atomic
+#define ATOMIC_INT(field) ((_Atomic int*)&(field))
+#define ATOMIC_STATE(field) ((_Atomic int64_t*)&(field))
+
+// Tag of the zero-byte wakeup messages sent on handle->comm, and the
+// doorbell bit of a consumer rank in FFQueue.sleepers
+#define FFQ_DOORBELL_TAG 1
+#define FFQ_SLEEPER_BIT(rank) ((int64_t)((uint64_t)1 << ((rank) % 64)))
+
+// A blocking dequeue returns false after polling a claimed rank this long,
+// keeping the rank for the next dequeue as a try-dequeue does. Measured in
+// time rather than retries so that it means the same under every wait
+// policy (a spinning consumer retries thousands of times per second).
+#define FFQ_DEQUEUE_TIMEOUT_S 10.0
+
+// Resizable rings. The capacity word packs the first rank of the current
+// size, the shifts giving the current and the previous size (max_size >>
+// shift) and a generation count. A new size is only published once every
+// rank of the generation before the current one is resolved, so a rank in
+// flight always maps through one of the two sizes the word describes.
+#define FFQ_CAPACITY(first, shift, previous, generation) \
+    ((int64_t)(((uint64_t)(uint32_t)(first) << 32) | ((uint64_t)(shift) << 24) | \
+               ((uint64_t)(previous) << 16) | (uint64_t)(uint16_t)(generation)))
+#define FFQ_CAPACITY_FIRST(capacity) ((int)(int32_t)((uint64_t)(capacity) >> 32))
+#define FFQ_CAPACITY_SHIFT(capacity) ((int)(((uint64_t)(capacity) >> 24) & 0xff))
+#define FFQ_CAPACITY_PREVIOUS(capacity) ((int)(((uint64_t)(capacity) >> 16) & 0xff))
+#define FFQ_CAPACITY_GENERATION(capacity) ((int)((uint64_t)(capacity) & 0xffff))
+
+// Enqueues between two checks of the producer for shrinking the ring
+#define FFQ_RESIZE_PERIOD 1024
 
 void do_work(int time_ms) {
     usleep(time_ms * 1000);
 }
 
-// Create MPI datatype for WeatherData - now returns it for caching
-static MPI_Datatype create_weather_data_type() {
+// Create MPI datatype for WeatherRecord - now returns it for caching
+static MPI_Datatype create_weather_record_type() {
     MPI_Datatype weather_type;
-    int blocklengths[] = {MAX_TIMESTAMP_LEN, MAX_CITY_LEN, 1, MAX_ICON_LEN, 1, 1, 1};
-    MPI_Datatype types[] = {MPI_CHAR, MPI_CHAR, MPI_INT, MPI_CHAR, MPI_FLOAT, MPI_INT, MPI_C_BOOL};
+    int blocklengths[] = {1, 1, 1, 1, 1, 1, 1};
+    MPI_Datatype types[] = {MPI_INT64_T, MPI_FLOAT, MPI_UINT16_T, MPI_UINT16_T, MPI_INT16_T, MPI_UINT8_T, MPI_UINT8_T};
     MPI_Aint offsets[7];
     
-    offsets[0] = offsetof(WeatherData, timestamp);
-    offsets[1] = offsetof(WeatherData, city);
-    offsets[2] = offsetof(WeatherData, aqi);
-    offsets[3] = offsetof(WeatherData, weather_icon);
-    offsets[4] = offsetof(WeatherData, wind_speed);
-    offsets[5] = offsetof(WeatherData, humidity);
-    offsets[6] = offsetof(WeatherData, valid);
+    offsets[0] = offsetof(WeatherRecord, timestamp_us);
+    offsets[1] = offsetof(WeatherRecord, wind_speed);
+    offsets[2] = offsetof(WeatherRecord, city_id);
+    offsets[3] = offsetof(WeatherRecord, icon_id);
+    offsets[4] = offsetof(WeatherRecord, aqi);
+    offsets[5] = offsetof(WeatherRecord, humidity);
+    offsets[6] = offsetof(WeatherRecord, flags);
     
-    MPI_Type_create_struct(7, blocklengths, offsets, types, &weather_type);
+    // Resize to the C struct so arrays of WeatherRecord can be sent as count > 1
+    MPI_Datatype packed_type;
+    MPI_Type_create_struct(7, blocklengths, offsets, types, &packed_type);
+    MPI_Type_create_resized(packed_type, 0, sizeof(WeatherRecord), &weather_type);
+    MPI_Type_free(&packed_type);
     MPI_Type_commit(&weather_type);
     
     return weather_type;
 }
 
-FFQHandle* ffq_init_optimized(int size, MPI_Win* win, MPI_Comm comm) {
-    int rank;
-    MPI_Comm_rank(comm, &rank);
+// Resize a type to the extent of one Cell so that count = k addresses the
+// same metadata field of k consecutive cells in the window
+static MPI_Datatype create_cell_strided_type(MPI_Datatype field_type) {
+    MPI_Datatype strided_type;
+    MPI_Type_create_resized(field_type, 0, sizeof(Cell), &strided_type);
+    MPI_Type_commit(&strided_type);
+    return strided_type;
+}
+
+// True when every rank of comm lives on the same node
+static bool all_ranks_share_node(MPI_Comm comm) {
+    int comm_size, node_size;
+    MPI_Comm node_comm;
+    
+    MPI_Comm_size(comm, &comm_size);
+    MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, 0, MPI_INFO_NULL, &node_comm);
+    MPI_Comm_size(node_comm, &node_size);
+    MPI_Comm_free(&node_comm);
+    
+    return node_size == comm_size;
+}
 
+// OPTIMIZATION: Sharded layout. The ring is cut into equal segments hosted
+// by ranks 1..P-1, so cell traffic is spread over all consumer nodes and
+// rank 0 only keeps the header (head, tail and counters).
+static FFQueue* init_sharded_window(int size, MPI_Comm comm, MPI_Win* win, int* segment_size,
+                                    MPI_Aint lane_bytes, MPI_Aint* lane_disp) {
+    int rank, comm_size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &comm_size);
+    
+    int hosts = comm_size > 1 ? comm_size - 1 : 1;
+    int first_host = comm_size > 1 ? 1 : 0;
+    *segment_size = (size + hosts - 1) / hosts;
+    
+    bool host = rank >= first_host;
+    MPI_Aint bytes = host ? FFQ_WINDOW_SIZE(*segment_size) : (MPI_Aint)sizeof(FFQueue);
+    *lane_disp = FFQ_ALIGN_UP(first_host ? (MPI_Aint)sizeof(FFQueue) : bytes);
+    if (rank == 0 && lane_bytes > 0) {
+        bytes = *lane_disp + lane_bytes;
+    }
+    
     FFQueue* queue = NULL;
+    MPI_Win_allocate(bytes, 1, MPI_INFO_NULL, comm, &queue, win);
     
-    // Calculate size needed for the window
-    MPI_Aint win_size = sizeof(FFQueue) + size * sizeof(Cell);
+    // The header of rank 0 describes the whole ring, the others their segment
+    queue->size = rank == 0 ? size : *segment_size;
+    queue->head = 0;
+    queue->tail = 0;
+    queue->lastItemDequeued = 0;
+    queue->producerLock = 0;
+    queue->sleepers = 0;
+    queue->capacity = 0;
+    queue->resolved[0] = 0;
+    queue->resolved[1] = 0;
+    
+    if (host) {
+        for (int i = 0; i < *segment_size; i++) {
+            queue->cells[i].state = FFQ_STATE(EMPTY_CELL, EMPTY_CELL);
+            queue->cells[i].lock = 0;
+            memset(FFQ_CELL_DATA(queue, i), 0, sizeof(WeatherRecord));
+        }
+    }
     
-    // Allocate the window
     if (rank == 0) {
-        MPI_Win_allocate(win_size, 1, MPI_INFO_NULL, comm, &queue, win);
-        
-        // Initialize queue
+        printf("Queue backend: RMA, sharded over %d rank(s) (%d cells each)\n", 
+               hosts, *segment_size);
+    }
+    return queue;
+}
+
+// OPTIMIZATION: Inbox layout. Every consumer rank hosts its own SPSC ring
+// and the producer pushes items into it, so an idle consumer polls local
+// memory instead of issuing RMA against rank 0. The capacity is split
+// evenly over the inboxes; rank 0 keeps only the header.
+static void* init_inbox_window(int size, MPI_Comm comm, MPI_Win* win, int* capacity,
+                               MPI_Aint lane_bytes, MPI_Aint* lane_disp) {
+    int rank, comm_size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &comm_size);
+    
+    int inboxes = comm_size - 1;
+    *capacity = (size + inboxes - 1) / inboxes;
+    
+    *lane_disp = FFQ_ALIGN_UP(sizeof(FFQueue));
+    MPI_Aint bytes = rank == 0 ? *lane_disp + lane_bytes : FFQ_INBOX_SIZE(*capacity);
+    
+    void* base = NULL;
+    MPI_Win_allocate(bytes, 1, MPI_INFO_NULL, comm, &base, win);
+    
+    if (rank == 0) {
+        FFQueue* queue = (FFQueue*)base;
         queue->size = size;
         queue->head = 0;
         queue->tail = 0;
         queue->lastItemDequeued = 0;
-        
-        // Initialize cells
-        for (int i = 0; i < size; i++) {
-            queue->cells[i].rank = EMPTY_CELL;
-            queue->cells[i].gap = EMPTY_CELL;
-            memset(&(queue->cells[i].data), 0, sizeof(WeatherData));
-            queue->cells[i].data.valid = false;
+        queue->producerLock = 0;
+        queue->sleepers = 0;
+        queue->capacity = 0;
+        queue->resolved[0] = 0;
+        queue->resolved[1] = 0;
+        printf("Queue backend: RMA, %d consumer inbox(es) of %d items\n", 
+               inboxes, *capacity);
+    } else {
+        FFQInbox* inbox = (FFQInbox*)base;
+        inbox->tail = 0;
+        inbox->head = 0;
+        memset(inbox->items, 0, *capacity * sizeof(WeatherRecord));
+    }
+    return base;
+}
+
+// Largest shift keeping max_size >> shift at least size (resizable rings)
+static int ring_shift(int max_size, int size) {
+    int shift = 0;
+    while ((max_size >> (shift + 1)) >= size) {
+        shift++;
+    }
+    return shift;
+}
+
+// Empty ring laid out for size cells, the first ready of them usable (a
+// resizable ring sets up the others when it grows)
+static void init_ring(FFQueue* queue, int size, int ready) {
+    queue->size = size;
+    queue->head = 0;
+    queue->tail = 0;
+    queue->lastItemDequeued = 0;
+    queue->producerLock = 0;
+    queue->sleepers = 0;
+    queue->capacity = 0;
+    queue->resolved[0] = 0;
+    queue->resolved[1] = 0;
+    
+    for (int i = 0; i < ready; i++) {
+        queue->cells[i].state = FFQ_STATE(EMPTY_CELL, EMPTY_CELL);
+        queue->cells[i].lock = 0;
+        memset(FFQ_CELL_DATA(queue, i), 0, sizeof(WeatherRecord));
+    }
+}
+
+// OPTIMIZATION: Priority lane. A small central ring placed lane_disp bytes
+// into rank 0's part of the window, so it needs no window, epoch or
+// datatype of its own: the lane's handle is a view sharing all of them.
+static FFQHandle* init_lane(const FFQHandle* handle, MPI_Aint lane_disp, int size) {
+    FFQHandle* lane = (FFQHandle*)malloc(sizeof(FFQHandle));
+    *lane = *handle;
+    lane->queue = handle->local_rank == 0 || handle->shared ?
+                  (FFQueue*)((char*)handle->queue + lane_disp) : NULL;
+    lane->base = handle->base + lane_disp;
+    lane->memory = NULL;
+    lane->local_size = size;
+    lane->segment_size = size;
+    lane->first_host = 0;
+    lane->layout = FFQ_LAYOUT_CENTRAL;
+    lane->inboxes = 0;
+    lane->inbox = NULL;
+    lane->inbox_head = NULL;
+    lane->inbox_tail = NULL;
+    lane->lane = NULL;
+    lane->max_size = 0;
+    lane->credit = -1; // Lane items count towards the ring's credit
+    return lane;
+}
+
+FFQHandle* ffq_init(int size, MPI_Comm comm, const FFQOptions* options) {
+    int rank, comm_size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &comm_size);
+
+    FFQueue* queue = NULL;
+    MPI_Win win;
+    
+    // Inboxes need at least one consumer and are filled by one producer
+    FFQLayout layout = options->layout;
+    if (layout == FFQ_LAYOUT_INBOX && (comm_size < 2 || options->producers > 1)) {
+        if (rank == 0) {
+            printf("Inbox layout needs one producer and a consumer, using central\n");
+        }
+        layout = FFQ_LAYOUT_CENTRAL;
+    }
+    
+    // An attached queue is a single block on rank 0 in a dynamic window
+    bool attached = options->window != MPI_WIN_NULL;
+    if (attached && layout != FFQ_LAYOUT_CENTRAL) {
+        if (rank == 0) {
+            printf("Queues in a shared dynamic window are central, ignoring the layout\n");
+        }
+        layout = FFQ_LAYOUT_CENTRAL;
+    }
+    
+    // A resizable ring reserves max_size cells and starts at the smallest
+    // of its sizes holding size cells
+    bool resizable = options->max_size > size;
+    if (resizable && (layout != FFQ_LAYOUT_CENTRAL || options->producers > 1)) {
+        if (rank == 0) {
+            printf("Resizable queues need the central layout and one producer, size fixed\n");
+        }
+        resizable = false;
+    }
+    if (options->steal && layout != FFQ_LAYOUT_INBOX && rank == 0) {
+        printf("Work stealing needs the inbox layout, disabled\n");
+    }
+    
+    int cells = resizable ? options->max_size : size;
+    int shift = resizable ? ring_shift(cells, size) : 0;
+    int start = cells >> shift;
+    
+    // Calculate size needed for the window. The priority lane, if any,
+    // follows the queue in rank 0's part of the window.
+    MPI_Aint win_size = FFQ_WINDOW_SIZE(cells);
+    MPI_Aint lane_bytes = options->priority_size > 0 ? FFQ_WINDOW_SIZE(options->priority_size) : 0;
+    MPI_Aint lane_disp = FFQ_ALIGN_UP(win_size);
+    
+    // OPTIMIZATION: Single node - put the queue in shared memory so cell
+    // accesses become cache-line transfers instead of RMA calls.
+    // Sharded, inbox and attached queues always go through RMA.
+    bool sharded = layout == FFQ_LAYOUT_SHARDED;
+    bool inboxes = layout == FFQ_LAYOUT_INBOX;
+    bool shared = layout == FFQ_LAYOUT_CENTRAL && !attached && all_ranks_share_node(comm);
+    int segment_size = cells;
+    FFQInbox* inbox = NULL;
+    MPI_Aint address = 0;
+    
+    // Allocate the window
+    if (attached) {
+        // Rank 0 attaches the queue; the others learn its address
+        win = options->window;
+        if (rank == 0) {
+            MPI_Aint bytes = lane_bytes > 0 ? lane_disp + lane_bytes : win_size;
+            queue = (FFQueue*)aligned_alloc(FFQ_CACHE_LINE, FFQ_ALIGN_UP(bytes));
+            MPI_Win_attach(win, queue, bytes);
+            MPI_Get_address(queue, &address);
+        }
+        MPI_Bcast(&address, 1, MPI_AINT, 0, comm);
+    } else if (sharded) {
+        queue = init_sharded_window(size, comm, &win, &segment_size, lane_bytes, &lane_disp);
+    } else if (inboxes) {
+        void* base = init_inbox_window(size, comm, &win, &segment_size, lane_bytes, &lane_disp);
+        if (rank == 0) {
+            queue = (FFQueue*)base;
+        } else {
+            inbox = (FFQInbox*)base;
+        }
+    } else if (rank == 0) {
+        MPI_Aint bytes = lane_bytes > 0 ? lane_disp + lane_bytes : win_size;
+        if (shared) {
+            MPI_Win_allocate_shared(bytes, 1, MPI_INFO_NULL, comm, &queue, &win);
+        } else {
+            MPI_Win_allocate(bytes, 1, MPI_INFO_NULL, comm, &queue, &win);
         }
+    } else if (shared) {
+        // Only rank 0 allocates memory, others map its segment directly
+        MPI_Aint segment_size;
+        int disp_unit;
+        MPI_Win_allocate_shared(0, 1, MPI_INFO_NULL, comm, &queue, &win);
+        MPI_Win_shared_query(win, 0, &segment_size, &disp_unit, &queue);
     } else {
         // Only rank 0 allocates memory, others just create the window
-        MPI_Win_allocate(0, 1, MPI_INFO_NULL, comm, &queue, win);
+        MPI_Win_allocate(0, 1, MPI_INFO_NULL, comm, &queue, &win);
+    }
+    
+    if (layout == FFQ_LAYOUT_CENTRAL && rank == 0) {
+        init_ring(queue, cells, start);
+        printf("Queue backend: %s\n", shared ? "shared memory" : "RMA");
+        if (resizable) {
+            queue->capacity = FFQ_CAPACITY(0, shift, shift, 0);
+            printf("Resizable ring: %d of %d cells\n", start, cells);
+        }
+    }
+    if (lane_bytes > 0 && rank == 0) {
+        init_ring((FFQueue*)((char*)queue + lane_disp), options->priority_size, options->priority_size);
+        printf("Priority lane: %d cells for AQI >= %d\n", options->priority_size, options->priority_aqi);
     }
     
     // Ensure all processes see initialized data
@@ -67,209 +349,1877 @@ FFQHandle* ffq_init_optimized(int size, MPI_Win* win, MPI_Comm comm) {
     // Create handle structure with cached data
     FFQHandle* handle = (FFQHandle*)malloc(sizeof(FFQHandle));
     handle->queue = queue;
-    handle->win = *win;
+    handle->win = win;
+    handle->attached = attached;
+    handle->base = address;
+    handle->memory = attached ? queue : NULL;
     handle->local_rank = rank;
+    handle->shared = shared;
+    handle->tail = 0;
+    handle->segment_size = segment_size;
+    handle->first_host = (sharded || inboxes) && comm_size > 1 ? 1 : 0;
+    handle->layout = layout;
+    handle->inboxes = inboxes ? comm_size - 1 : 0;
+    handle->inbox = inbox;
+    handle->inbox_head = NULL;
+    handle->inbox_tail = NULL;
+    handle->wait = options->wait;
+    handle->producers = options->producers;
+    handle->lane = NULL;
+    handle->priority_aqi = options->priority_aqi;
+    handle->pending = -1;
+    handle->doorbell = MPI_REQUEST_NULL;
+    handle->batch_first = 0;
+    handle->batch_count = 0;
+    handle->max_size = resizable ? cells : 0;
+    handle->min_size = start;
+    handle->capacity = resizable ? FFQ_CAPACITY(0, shift, shift, 0) : 0;
+    handle->initialized = start;
+    handle->quiet = 0;
+    handle->steal = inboxes && options->steal;
+    handle->credit = layout != FFQ_LAYOUT_INBOX && !resizable && options->producers == 1 ? 0 : -1;
+    handle->published = 0;
+    if (inboxes && rank == 0) {
+        handle->inbox_head = (int*)calloc(handle->inboxes, sizeof(int));
+        handle->inbox_tail = (int*)calloc(handle->inboxes, sizeof(int));
+    }
     
-    // Cache the queue size locally (it never changes)
-    if (rank == 0) {
-        handle->local_size = size;
+    // Wakeups travel on a private communicator so they never match
+    // messages of the application
+    MPI_Comm_dup(comm, &handle->comm);
+    
+    // OPTIMIZATION: One passive-target epoch for the lifetime of the handle.
+    // Every operation below completes with MPI_Win_flush, never lock/unlock.
+    // An attached queue uses the epoch of the window's owner.
+    if (!attached) {
+        MPI_Win_lock_all(0, win);
+    }
+    
+    // Cache the queue size locally. A sharded window header only describes
+    // the local segment and a resizable one the reserve, so take the size
+    // computed above.
+    if (sharded || inboxes || resizable) {
+        handle->local_size = start;
+    } else if (rank == 0 || shared) {
+        handle->local_size = queue->size;
     } else {
         // Non-root processes need to read it once
-        MPI_Win_lock(MPI_LOCK_SHARED, 0, 0, *win);
         MPI_Get(&handle->local_size, 1, MPI_INT, 0, 
-                offsetof(FFQueue, size), 1, MPI_INT, *win);
-        MPI_Win_flush(0, *win);
-        MPI_Win_unlock(0, *win);
+                FFQ_FIELD_DISP(handle, size), 1, MPI_INT, win);
+        MPI_Win_flush(0, win);
     }
     
     // Create and cache the weather datatype (MAJOR OPTIMIZATION)
-    handle->weather_type = create_weather_data_type();
+    handle->weather_type = create_weather_record_type();
+    handle->cell_state_type = create_cell_strided_type(MPI_INT64_T);
     
+    if (lane_bytes > 0) {
+        handle->lane = init_lane(handle, lane_disp, options->priority_size);
+    }
     return handle;
 }
 
-void ffq_cleanup_optimized(FFQHandle* handle) {
+void ffq_cleanup(FFQHandle* handle) {
     if (handle) {
         if (handle->weather_type != MPI_DATATYPE_NULL) {
             MPI_Type_free(&handle->weather_type);
         }
+        if (handle->cell_state_type != MPI_DATATYPE_NULL) {
+            MPI_Type_free(&handle->cell_state_type);
+        }
+        if (handle->memory) {
+            MPI_Win_detach(handle->win, handle->memory);
+            free(handle->memory);
+        } else if (!handle->attached) {
+            MPI_Win_unlock_all(handle->win);
+            MPI_Win_free(&handle->win);
+        }
+        
+        // Consume wakeups that were sent to consumers which never blocked,
+        // including the one a posted receive may be waiting for
+        if (handle->doorbell != MPI_REQUEST_NULL) {
+            MPI_Cancel(&handle->doorbell);
+            MPI_Wait(&handle->doorbell, MPI_STATUS_IGNORE);
+        }
+        int stale = 1;
+        while (stale) {
+            MPI_Iprobe(MPI_ANY_SOURCE, FFQ_DOORBELL_TAG, handle->comm, &stale, MPI_STATUS_IGNORE);
+            if (stale) {
+                MPI_Recv(NULL, 0, MPI_BYTE, MPI_ANY_SOURCE, FFQ_DOORBELL_TAG, handle->comm, MPI_STATUS_IGNORE);
+            }
+        }
+        MPI_Comm_free(&handle->comm);
+        free(handle->inbox_head);
+        free(handle->inbox_tail);
+        free(handle->lane);
         free(handle);
     }
 }
 
-bool ffq_enqueue_optimized(FFQHandle* handle, WeatherData item) {
+void ffq_publish_tail(FFQHandle* handle) {
+    if (handle->producers > 1) {
+        return; // The shared tail is already current
+    }
+    if (handle->shared) {
+        atomic_store_explicit(ATOMIC_INT(handle->queue->tail), handle->tail, memory_order_relaxed);
+        return;
+    }
+    MPI_Accumulate(&handle->tail, 1, MPI_INT, 0,
+                   FFQ_FIELD_DISP(handle, tail),
+                   1, MPI_INT, MPI_REPLACE, handle->win);
+    MPI_Win_flush(0, handle->win);
+}
+
+// Rank whose window holds cell idx (always 0 unless sharded)
+static inline int cell_host(const FFQHandle* handle, int idx) {
+    return handle->first_host + idx / handle->segment_size;
+}
+
+// Position of cell idx within its host's window
+static inline int cell_slot(const FFQHandle* handle, int idx) {
+    return idx % handle->segment_size;
+}
+
+// Number of cells from idx on that are contiguous in one window: runs stop
+// at the end of the ring and at the end of a segment
+static inline int cell_run(const FFQHandle* handle, int idx) {
+    int to_ring_end = handle->local_size - idx;
+    int to_segment_end = handle->segment_size - cell_slot(handle, idx);
+    return to_ring_end < to_segment_end ? to_ring_end : to_segment_end;
+}
+
+#define CELL_STATE_DISP(handle, idx) \
+    ((handle)->base + (MPI_Aint)offsetof(FFQueue, cells[cell_slot(handle, idx)].state))
+#define CELL_LOCK_DISP(handle, idx) \
+    ((handle)->base + (MPI_Aint)offsetof(FFQueue, cells[cell_slot(handle, idx)].lock))
+#define CELL_DATA_DISP(handle, idx) \
+    ((handle)->base + FFQ_DATA_DISP((handle)->segment_size, cell_slot(handle, idx)))
+
+// Complete pending operations on every rank the queue lives on
+static void flush_queue(FFQHandle* handle) {
+    if (handle->first_host == 0) {
+        MPI_Win_flush(0, handle->win);
+    } else {
+        MPI_Win_flush_all(handle->win);
+    }
+}
+
+// Atomically read the packed rank/gap state of cell idx
+static int64_t read_cell_state(FFQHandle* handle, int idx) {
+    int64_t state;
+    int host = cell_host(handle, idx);
+    MPI_Fetch_and_op(NULL, &state, MPI_INT64_T, host,
+                     CELL_STATE_DISP(handle, idx),
+                     MPI_NO_OP, handle->win);
+    MPI_Win_flush(host, handle->win);
+    return state;
+}
+
+// Atomically XOR flip into the state of cell idx. flip must stay valid
+// until the next flush of the cell's host.
+static void flip_cell_state(FFQHandle* handle, int idx, const int64_t* flip) {
+    MPI_Accumulate(flip, 1, MPI_INT64_T, cell_host(handle, idx),
+                   CELL_STATE_DISP(handle, idx),
+                   1, MPI_INT64_T, MPI_BXOR, handle->win);
+}
+
+// Size of the ring rank maps to under a capacity word
+static inline int ring_size(const FFQHandle* handle, int64_t capacity, int rank) {
+    int shift = rank >= FFQ_CAPACITY_FIRST(capacity) ? 
+                FFQ_CAPACITY_SHIFT(capacity) : FFQ_CAPACITY_PREVIOUS(capacity);
+    return handle->max_size >> shift;
+}
+
+// Cell of rank as far as this process knows the capacity
+static inline int rank_cell(const FFQHandle* handle, int rank) {
+    if (handle->max_size == 0) {
+        return rank % handle->local_size;
+    }
+    return rank % ring_size(handle, handle->capacity, rank);
+}
+
+// Resolved counter (FFQueue.resolved) of the generation of rank
+static inline int ring_parity(int64_t capacity, int rank) {
+    return (FFQ_CAPACITY_GENERATION(capacity) - (rank < FFQ_CAPACITY_FIRST(capacity) ? 1 : 0)) & 1;
+}
+
+// OPTIMIZATION: Resizable ring. The window reserves max_size cells, so a
+// new size needs no allocation or collective call: ranks from the tail on
+// map to rank % new_size, which only needs a new capacity word. Cells of
+// the old size still holding items are skipped by the producer like any
+// busy cell. Consumers check their cell against the word whenever it
+// does not show their rank (see ffq_dequeue). Memory follows the largest
+// size used: cells are set up when first needed, never given back.
+bool ffq_resize(FFQHandle* handle, int size) {
+    if (handle->max_size == 0) {
+        return false;
+    }
+    int shift = ring_shift(handle->max_size, size < 2 ? 2 : size);
+    int new_size = handle->max_size >> shift;
+    if (new_size == handle->local_size) {
+        return true;
+    }
+    
+    // Only the producer writes the word, so its copy is current. The
+    // generation before the current one must be fully resolved: the word
+    // will no longer describe it and the new one reuses its counter.
+    int64_t capacity = handle->capacity;
+    int generation = FFQ_CAPACITY_GENERATION(capacity);
+    int retired = FFQ_CAPACITY_FIRST(capacity) - handle->tail;
+    int64_t next = FFQ_CAPACITY(handle->tail, shift, FFQ_CAPACITY_SHIFT(capacity), generation + 1);
+    
+    if (handle->shared) {
+        FFQueue* queue = handle->queue;
+        if (atomic_load_explicit(ATOMIC_INT(queue->resolved[(generation - 1) & 1]), 
+                                 memory_order_acquire) != 0) {
+            return false;
+        }
+        for (int i = handle->initialized; i < new_size; i++) {
+            queue->cells[i].state = FFQ_STATE(EMPTY_CELL, EMPTY_CELL);
+        }
+        
+        // The ranks of the current generation are known now; its counter
+        // comes back to zero once consumers resolved all of them
+        atomic_fetch_add_explicit(ATOMIC_INT(queue->resolved[generation & 1]), retired, 
+                                  memory_order_relaxed);
+        atomic_store_explicit(ATOMIC_STATE(queue->capacity), next, memory_order_release);
+    } else {
+        int unresolved;
+        MPI_Fetch_and_op(NULL, &unresolved, MPI_INT, 0, 
+                         FFQ_FIELD_DISP(handle, resolved[(generation - 1) & 1]), 
+                         MPI_NO_OP, handle->win);
+        MPI_Win_flush(0, handle->win);
+        if (unresolved != 0) {
+            return false;
+        }
+        
+        if (new_size > handle->initialized) {
+            int count = new_size - handle->initialized;
+            int64_t* states = (int64_t*)malloc(count * sizeof(int64_t));
+            for (int i = 0; i < count; i++) {
+                states[i] = FFQ_STATE(EMPTY_CELL, EMPTY_CELL);
+            }
+            MPI_Put(states, count, MPI_INT64_T, 0, 
+                    CELL_STATE_DISP(handle, handle->initialized), 
+                    count, handle->cell_state_type, handle->win);
+            MPI_Win_flush(0, handle->win);
+            free(states);
+        }
+        
+        MPI_Accumulate(&retired, 1, MPI_INT, 0, 
+                       FFQ_FIELD_DISP(handle, resolved[generation & 1]), 
+                       1, MPI_INT, MPI_SUM, handle->win);
+        MPI_Accumulate(&next, 1, MPI_INT64_T, 0, 
+                       FFQ_FIELD_DISP(handle, capacity), 
+                       1, MPI_INT64_T, MPI_REPLACE, handle->win);
+        MPI_Win_flush(0, handle->win);
+    }
+    
+    printf("Producer resized the ring from %d to %d cells at rank %d\n", 
+           handle->local_size, new_size, handle->tail);
+    handle->capacity = next;
+    handle->local_size = new_size;
+    if (new_size > handle->initialized) {
+        handle->initialized = new_size;
+    }
+    return true;
+}
+
+// Automatic resizing after count items were enqueued in a resizable ring:
+// double it when the producer had to skip cells, halve it when it is at
+// most a quarter full after FFQ_RESIZE_PERIOD items without skips
+static void adapt_capacity(FFQHandle* handle, int count, bool skipped) {
+    if (skipped) {
+        handle->quiet = 0;
+        if (handle->local_size < handle->max_size) {
+            ffq_resize(handle, handle->local_size * 2);
+        }
+        return;
+    }
+    handle->quiet += count;
+    if (handle->quiet < FFQ_RESIZE_PERIOD || handle->local_size == handle->min_size) {
+        return;
+    }
+    handle->quiet = 0;
+    
+    int head;
+    if (handle->shared) {
+        head = atomic_load_explicit(ATOMIC_INT(handle->queue->head), memory_order_relaxed);
+    } else {
+        MPI_Fetch_and_op(NULL, &head, MPI_INT, 0, FFQ_FIELD_DISP(handle, head), MPI_NO_OP, handle->win);
+        MPI_Win_flush(0, handle->win);
+    }
+    if (handle->tail - head <= handle->local_size / 4) {
+        ffq_resize(handle, handle->local_size / 2);
+    }
+}
+
+// Resizable ring (RMA): count rank as resolved for its generation. The
+// capacity word must have been read after the state showed the producer
+// got past rank. Completed by the caller's next flush of rank 0.
+static void resolve_rank(FFQHandle* handle, int64_t capacity, int rank) {
+    static const int one = 1;
+    MPI_Accumulate(&one, 1, MPI_INT, 0, 
+                   FFQ_FIELD_DISP(handle, resolved[ring_parity(capacity, rank)]), 
+                   1, MPI_INT, MPI_SUM, handle->win);
+}
+
+// OPTIMIZATION: Doorbell (block wait policy). A consumer that finds
+// nothing to take sets its bit in the header, checks its cells once more
+// and then blocks in a receive instead of sleeping for a guessed interval.
+// The producer looks at the bits after every publish and sends a zero-byte
+// message to each sleeper. Either the consumer's recheck sees the publish
+// or the producer sees the bit, so no wakeup is lost; a stale message only
+// causes one extra recheck. MPI has no receive with a timeout, so the
+// receive is posted and tested until the caller's deadline; one that is
+// still pending then stays posted for the next wait, keeping its wakeup.
+static void doorbell_arm(FFQHandle* handle) {
+    int64_t bit = FFQ_SLEEPER_BIT(handle->local_rank);
+    if (handle->shared) {
+        atomic_fetch_or_explicit(ATOMIC_STATE(handle->queue->sleepers), bit, memory_order_seq_cst);
+        return;
+    }
+    MPI_Accumulate(&bit, 1, MPI_INT64_T, 0, FFQ_FIELD_DISP(handle, sleepers),
+                   1, MPI_INT64_T, MPI_BOR, handle->win);
+    MPI_Win_flush(0, handle->win);
+}
+
+static void doorbell_wait(FFQHandle* handle, double deadline) {
+    if (handle->doorbell == MPI_REQUEST_NULL) {
+        MPI_Irecv(NULL, 0, MPI_BYTE, MPI_ANY_SOURCE, FFQ_DOORBELL_TAG, handle->comm, &handle->doorbell);
+    }
+    int rung = 0;
+    MPI_Test(&handle->doorbell, &rung, MPI_STATUS_IGNORE);
+    while (!rung && MPI_Wtime() < deadline) {
+        usleep(handle->wait.min_us);
+        MPI_Test(&handle->doorbell, &rung, MPI_STATUS_IGNORE);
+    }
+}
+
+// Wake every consumer that armed the doorbell (producers, after a publish)
+static void doorbell_ring(FFQHandle* handle) {
+    int64_t none = 0, sleepers;
+    
+    if (handle->shared) {
+        // Order the publish before the look at the bits
+        atomic_thread_fence(memory_order_seq_cst);
+        _Atomic int64_t* word = ATOMIC_STATE(handle->queue->sleepers);
+        if (atomic_load_explicit(word, memory_order_relaxed) == 0) {
+            return;
+        }
+        sleepers = atomic_exchange_explicit(word, none, memory_order_seq_cst);
+    } else {
+        // When the header is in the producer's own window, peek locally
+        // first so a publish nobody waits for costs no RMA call
+        if (handle->local_rank == 0) {
+            MPI_Win_sync(handle->win);
+            if (atomic_load_explicit(ATOMIC_STATE(handle->queue->sleepers), memory_order_acquire) == 0) {
+                return;
+            }
+        }
+        MPI_Fetch_and_op(&none, &sleepers, MPI_INT64_T, 0, FFQ_FIELD_DISP(handle, sleepers),
+                         MPI_REPLACE, handle->win);
+        MPI_Win_flush(0, handle->win);
+    }
+    
+    int comm_size;
+    MPI_Comm_size(handle->comm, &comm_size);
+    for (int rank = 0; rank < comm_size; rank++) {
+        if (sleepers & FFQ_SLEEPER_BIT(rank)) {
+            MPI_Send(NULL, 0, MPI_BYTE, rank, FFQ_DOORBELL_TAG, handle->comm);
+        }
+    }
+}
+
+// One wait of a consumer for a publish. Once a block policy is done
+// yielding, the first call arms the doorbell (the caller then looks again)
+// and the next blocks, at most until deadline.
+static void consumer_wait(FFQHandle* handle, Waiter* waiter, bool* armed, double deadline) {
+    if (!waiter_should_block(waiter)) {
+        waiter_pause(waiter);
+    } else if (!*armed) {
+        doorbell_arm(handle);
+        *armed = true;
+    } else {
+        doorbell_wait(handle, deadline);
+        *armed = false;
+    }
+}
+
+// Take the item at the head of the priority lane if it is published,
+// without waiting. Lane ranks are claimed by compare-and-swap of the head
+// once their cell is resolved (published or skipped), never ahead of the
+// producer, so no consumer holds a lane rank it would have to wait for.
+// Items count towards the ring's lastItemDequeued.
+static bool lane_take(FFQHandle* handle, int consumer_id, WeatherRecord* item) {
+    FFQHandle* lane = handle->lane;
+    
+    if (lane->shared) {
+        FFQueue* queue = lane->queue;
+        while (true) {
+            int head = atomic_load_explicit(ATOMIC_INT(queue->head), memory_order_relaxed);
+            int idx = head % lane->local_size;
+            _Atomic int64_t* state_word = ATOMIC_STATE(queue->cells[idx].state);
+            int64_t state = atomic_load_explicit(state_word, memory_order_acquire);
+            bool ready = FFQ_STATE_RANK(state) == head;
+            
+            if (!ready && FFQ_STATE_GAP(state) < head) {
+                return false; // Nothing published at the head yet
+            }
+            if (!atomic_compare_exchange_strong_explicit(ATOMIC_INT(queue->head), &head, head + 1,
+                                                         memory_order_relaxed, memory_order_relaxed)) {
+                continue; // Another consumer moved the head
+            }
+            if (ready) {
+                *item = *FFQ_CELL_DATA(queue, idx);
+                atomic_fetch_xor_explicit(state_word, FFQ_RANK_FLIP(head, EMPTY_CELL),
+                                          memory_order_release);
+                atomic_fetch_add_explicit(ATOMIC_INT(handle->queue->lastItemDequeued), 1,
+                                          memory_order_relaxed);
+                printf("Consumer %d dequeued priority item (city %u, aqi %d) from lane cell %d (rank %d)\n",
+                       consumer_id, item->city_id, item->aqi, idx, head);
+                return true;
+            }
+        }
+    }
+    
+    // Only the head cell's state is read, so a poll costs the same whatever
+    // the lane size
+    const int one = 1;
+    while (true) {
+        int head, previous;
+        MPI_Fetch_and_op(NULL, &head, MPI_INT, 0, FFQ_FIELD_DISP(lane, head), MPI_NO_OP, lane->win);
+        MPI_Win_flush(0, lane->win);
+        
+        int idx = head % lane->local_size;
+        int64_t state = read_cell_state(lane, idx);
+        bool ready = FFQ_STATE_RANK(state) == head;
+        if (!ready && FFQ_STATE_GAP(state) < head) {
+            return false;
+        }
+        
+        int next = head + 1;
+        MPI_Compare_and_swap(&next, &head, &previous, MPI_INT, 0,
+                             FFQ_FIELD_DISP(lane, head), lane->win);
+        MPI_Win_flush(0, lane->win);
+        if (previous != head || !ready) {
+            continue;
+        }
+        
+        MPI_Get(item, 1, lane->weather_type, 0, CELL_DATA_DISP(lane, idx),
+                1, lane->weather_type, lane->win);
+        MPI_Win_flush(0, lane->win);
+        
+        int64_t flip = FFQ_RANK_FLIP(head, EMPTY_CELL);
+        flip_cell_state(lane, idx, &flip);
+        MPI_Accumulate(&one, 1, MPI_INT, 0, FFQ_FIELD_DISP(handle, lastItemDequeued),
+                       1, MPI_INT, MPI_SUM, handle->win);
+        MPI_Win_flush(0, handle->win);
+        
+        printf("Consumer %d dequeued priority item (city %u, aqi %d) from lane cell %d (rank %d)\n",
+               consumer_id, item->city_id, item->aqi, idx, head);
+        return true;
+    }
+}
+
+// Whether the priority lane has a free cell for the next rank. Consumers
+// drain the lane only between bulk ranks, so an alert that finds it full
+// takes the bulk ring rather than waiting on consumers that may be waiting
+// on this producer. Gaps count as taken until the head moves past them.
+static bool lane_has_room(FFQHandle* handle) {
+    FFQHandle* lane = handle->lane;
+    int head, tail = lane->tail;
+    
+    if (lane->shared) {
+        head = atomic_load_explicit(ATOMIC_INT(lane->queue->head), memory_order_relaxed);
+        if (lane->producers > 1) {
+            tail = atomic_load_explicit(ATOMIC_INT(lane->queue->tail), memory_order_relaxed);
+        }
+    } else {
+        MPI_Fetch_and_op(NULL, &head, MPI_INT, 0, FFQ_FIELD_DISP(lane, head), MPI_NO_OP, lane->win);
+        if (lane->producers > 1) {
+            MPI_Fetch_and_op(NULL, &tail, MPI_INT, 0, FFQ_FIELD_DISP(lane, tail), MPI_NO_OP, lane->win);
+        }
+        MPI_Win_flush(0, lane->win);
+    }
+    return tail - head < lane->local_size;
+}
+
+// OPTIMIZATION: Credit-based flow control (fixed-size ring, one producer).
+// The producer counts the items it published and the consumers count the
+// ones they took in lastItemDequeued, so the difference is the number of
+// cells holding an item. On a full ring the producer waits for credit,
+// one read of the counter per wait, instead of marking gap after gap
+// around the ring; gaps then only appear where a cell is freed out of
+// order. The credit is cached and read back only once it runs out.
+// Lane items are counted too, as consumers count them in the ring's
+// counter, which only makes the credit err on the low side.
+static int ring_credit(FFQHandle* handle) {
+    if (handle->credit == 0) {
+        int dequeued;
+        if (handle->shared || handle->local_rank == 0) {
+            if (!handle->shared) {
+                MPI_Win_sync(handle->win);
+            }
+            dequeued = atomic_load_explicit(ATOMIC_INT(handle->queue->lastItemDequeued), memory_order_acquire);
+        } else {
+            MPI_Fetch_and_op(NULL, &dequeued, MPI_INT, 0, FFQ_FIELD_DISP(handle, lastItemDequeued), 
+                             MPI_NO_OP, handle->win);
+            MPI_Win_flush(0, handle->win);
+        }
+        int credit = handle->local_size - (handle->published - dequeued);
+        handle->credit = credit > 0 ? credit : 0;
+    }
+    return handle->credit;
+}
+
+// Wait until a credit-tracked ring has a free cell
+static void await_credit(FFQHandle* handle) {
+    if (handle->credit < 0 || ring_credit(handle) > 0) {
+        return;
+    }
+    
+    printf("Producer waiting for credit, ring full\n");
+    Waiter waiter;
+    waiter_init(&waiter, &handle->wait);
+    while (ring_credit(handle) == 0) {
+        waiter_pause(&waiter);
+    }
+}
+
+// Count n published items against the credit
+static void spend_credit(FFQHandle* handle, int n) {
+    if (handle->credit >= 0) {
+        handle->published += n;
+        handle->credit = handle->credit > n ? handle->credit - n : 0;
+    }
+}
+
+int ffq_credit(FFQHandle* handle) {
+    return handle->credit < 0 ? INT_MAX : ring_credit(handle);
+}
+
+// Shared-memory enqueue: cells are written in place, the release XOR
+// of the state word publishes the data written before it
+static bool ffq_enqueue_shared(FFQHandle* handle, WeatherRecord item) {
+    FFQueue* queue = handle->queue;
     bool success = false;
-    int local_tail = handle->queue->tail; // Cache the tail value
-    int backoff_us = 100;  // Start with 100 microseconds
-    const int MAX_BACKOFF = 10000;  // Max 10ms
+    bool skipped = false;
+    int local_tail = handle->tail;
+    Waiter waiter;
+    waiter_init(&waiter, &handle->wait);
+    await_credit(handle);
     
     while (!success) {
-        // OPTIMIZATION: Single lock for the entire operation
-        MPI_Win_lock(MPI_LOCK_EXCLUSIVE, 0, 0, handle->win);
-        
         int idx = local_tail % handle->local_size;
+        _Atomic int64_t* state_word = ATOMIC_STATE(queue->cells[idx].state);
+        int64_t state = atomic_load_explicit(state_word, memory_order_acquire);
+        
+        if (FFQ_STATE_RANK(state) < 0) {
+            *FFQ_CELL_DATA(queue, idx) = item;
+            atomic_fetch_xor_explicit(state_word, FFQ_RANK_FLIP(EMPTY_CELL, local_tail),
+                                      memory_order_release);
+            spend_credit(handle, 1);
+            
+            success = true;
+            printf("Producer enqueued item for city %u at cell %d (rank %d)\n",
+                   item.city_id, idx, local_tail);
+        } else {
+            atomic_fetch_xor_explicit(state_word, FFQ_GAP_FLIP(FFQ_STATE_GAP(state), local_tail),
+                                      memory_order_release);
+            
+            skipped = true;
+            printf("Producer skipped cell %d (rank %d)\n", idx, local_tail);
+        }
+        doorbell_ring(handle);
+        
+        local_tail++;
         
-        // Read the cell's rank value
-        int cell_rank;
-        MPI_Get(&cell_rank, 1, MPI_INT, 0, 
-                offsetof(FFQueue, cells[idx].rank), 
-                1, MPI_INT, handle->win);
+        if (!success) {
+            waiter_pause(&waiter);
+        }
+    }
+    
+    handle->tail = local_tail;
+    if (handle->max_size > 0) {
+        adapt_capacity(handle, 1, skipped);
+    }
+    return success;
+}
+
+// Shared-memory dequeue: head is claimed with atomic_fetch_add and the
+// cell is recycled with a release XOR after the data has been copied.
+// Without wait, or once the dequeue times out, a rank the producer has not
+// written yet is kept pending.
+static bool ffq_dequeue_shared(FFQHandle* handle, int consumer_id, WeatherRecord* item, bool wait) {
+    FFQueue* queue = handle->queue;
+    int fetch_rank = handle->pending;
+    if (fetch_rank < 0) {
+        fetch_rank = atomic_fetch_add_explicit(ATOMIC_INT(queue->head), 1, memory_order_relaxed);
+    }
+    handle->pending = -1;
+    int idx = rank_cell(handle, fetch_rank);
+    bool success = false;
+    bool armed = false;
+    Waiter waiter;
+    waiter_init(&waiter, &handle->wait);
+    double deadline = MPI_Wtime() + FFQ_DEQUEUE_TIMEOUT_S;
+    
+    while (!success) {
+        _Atomic int64_t* state_word = ATOMIC_STATE(queue->cells[idx].state);
+        int64_t state = atomic_load_explicit(state_word, memory_order_acquire);
+        
+        if (handle->max_size > 0 && FFQ_STATE_RANK(state) != fetch_rank) {
+            // Loaded after the state: once that shows the producer got past
+            // the rank, the word maps it as the producer did
+            handle->capacity = atomic_load_explicit(ATOMIC_STATE(queue->capacity), memory_order_acquire);
+            int cell = fetch_rank % ring_size(handle, handle->capacity, fetch_rank);
+            if (cell != idx) {
+                idx = cell;
+                continue;
+            }
+        }
+        bool skipped = FFQ_STATE_RANK(state) != fetch_rank && FFQ_STATE_GAP(state) >= fetch_rank;
+        
+        if (handle->lane && !skipped && lane_take(handle, consumer_id, item)) {
+            // A priority item overtakes the claimed rank, kept for the next call
+            handle->pending = fetch_rank;
+            success = true;
+        }
+        else if (FFQ_STATE_RANK(state) == fetch_rank) {
+            *item = *FFQ_CELL_DATA(queue, idx);
+            atomic_fetch_xor_explicit(state_word, FFQ_RANK_FLIP(fetch_rank, EMPTY_CELL),
+                                      memory_order_release);
+            atomic_fetch_add_explicit(ATOMIC_INT(queue->lastItemDequeued), 1, memory_order_relaxed);
+            if (handle->max_size > 0) {
+                handle->capacity = atomic_load_explicit(ATOMIC_STATE(queue->capacity), memory_order_acquire);
+                atomic_fetch_add_explicit(ATOMIC_INT(queue->resolved[ring_parity(handle->capacity, fetch_rank)]),
+                                          1, memory_order_relaxed);
+            }
+            
+            success = true;
+            printf("Consumer %d dequeued item for (timestamp %lld, city %u, aqi %d, wind_speed %f, humidity %u) from cell %d (rank %d)\n",
+                   consumer_id, (long long)item->timestamp_us, item->city_id, item->aqi, item->wind_speed, item->humidity, idx, fetch_rank);
+        } 
+        else if (skipped) {
+            if (handle->max_size > 0) {
+                atomic_fetch_add_explicit(ATOMIC_INT(queue->resolved[ring_parity(handle->capacity, fetch_rank)]),
+                                          1, memory_order_relaxed);
+            }
+            fetch_rank = atomic_fetch_add_explicit(ATOMIC_INT(queue->head), 1, memory_order_relaxed);
+            idx = rank_cell(handle, fetch_rank);
+            printf("Consumer %d skipped to rank %d (cell %d)\n", 
+                   consumer_id, fetch_rank, idx);
+        } 
+        else if (!wait || MPI_Wtime() >= deadline) {
+            // As on the RMA path, the deadline is only honoured after a
+            // look at the cell and the rank is kept
+            if (wait) {
+                fprintf(stderr, "Consumer %d: Dequeue timeout after %.0f s\n",
+                        consumer_id, FFQ_DEQUEUE_TIMEOUT_S);
+            }
+            handle->pending = fetch_rank;
+            break;
+        }
+        else {
+            // Producer has not written the cell yet
+            consumer_wait(handle, &waiter, &armed, deadline);
+        }
+    }
+    
+    return success;
+}
+
+// Inbox layout: rank r goes to inbox r % inboxes at position r / inboxes.
+// Returns how many of the next remaining ranks fit the credit the producer
+// knows of, i.e. the free slots seen at its last read of each inbox head.
+static int inbox_credit_run(const FFQHandle* handle, int tail, int remaining) {
+    int run = remaining;
+    for (int i = 0; i < handle->inboxes; i++) {
+        int first = tail + (i - tail % handle->inboxes + handle->inboxes) % handle->inboxes;
+        int credit = handle->segment_size - (first / handle->inboxes - handle->inbox_head[i]);
+        int limit = first + credit * handle->inboxes - tail;
+        run = limit < run ? limit : run;
+    }
+    return run;
+}
+
+// OPTIMIZATION: Push dispatch. Items are dealt round-robin to the consumer
+// inboxes: per inbox one Put (two at the ring end) for its share of the
+// batch, then one atomic tail update. Heads are read back only when the
+// cached credit runs out. Strict round-robin keeps the one-sentinel-per-
+// consumer protocol intact, at the price of waiting on a full inbox.
+// Rounds carry at most ENQUEUE_BATCH_SIZE items, staged on the stack.
+static int ffq_enqueue_inbox(FFQHandle* handle, const WeatherRecord* items, int n) {
+    int inboxes = handle->inboxes;
+    int capacity = handle->segment_size;
+    WeatherRecord staged[ENQUEUE_BATCH_SIZE];
+    int* tails = handle->inbox_tail;
+    Waiter waiter;
+    waiter_init(&waiter, &handle->wait);
+    int done = 0;
+    
+    while (done < n) {
+        int tail = handle->tail;
+        int want = n - done < ENQUEUE_BATCH_SIZE ? n - done : ENQUEUE_BATCH_SIZE;
+        int run = inbox_credit_run(handle, tail, want);
+        
+        if (run < want) {
+            // Out of known credit: refresh every head in one round trip
+            for (int i = 0; i < inboxes; i++) {
+                MPI_Fetch_and_op(NULL, &handle->inbox_head[i], MPI_INT, handle->first_host + i,
+                                 offsetof(FFQInbox, head), MPI_NO_OP, handle->win);
+            }
+            MPI_Win_flush_all(handle->win);
+            run = inbox_credit_run(handle, tail, want);
+        }
+        
+        if (run == 0) {
+            waiter_pause(&waiter);
+            continue;
+        }
+        waiter_reset(&waiter);
+        
+        WeatherRecord* next = staged;
+        for (int i = 0; i < inboxes; i++) {
+            int first = tail + (i - tail % inboxes + inboxes) % inboxes;
+            tails[i] = -1;
+            if (first >= tail + run) {
+                continue;
+            }
+            
+            // Gather this inbox's share so it lands with one Put
+            int count = (tail + run - 1 - first) / inboxes + 1;
+            for (int k = 0; k < count; k++) {
+                next[k] = items[done + first - tail + k * inboxes];
+            }
+            
+            int pos = first / inboxes;
+            int slot = pos % capacity;
+            int part = capacity - slot < count ? capacity - slot : count;
+            MPI_Put(next, part, handle->weather_type, handle->first_host + i,
+                    offsetof(FFQInbox, items[slot]), 
+                    part, handle->weather_type, handle->win);
+            if (part < count) {
+                MPI_Put(next + part, count - part, handle->weather_type, handle->first_host + i,
+                        offsetof(FFQInbox, items[0]), 
+                        count - part, handle->weather_type, handle->win);
+            }
+            tails[i] = pos + count;
+            next += count;
+        }
+        MPI_Win_flush_all(handle->win);
+        
+        // Data is complete at every target, now hand it over
+        for (int i = 0; i < inboxes; i++) {
+            if (tails[i] >= 0) {
+                MPI_Accumulate(&tails[i], 1, MPI_INT, handle->first_host + i,
+                               offsetof(FFQInbox, tail), 1, MPI_INT, MPI_REPLACE, handle->win);
+            }
+        }
+        MPI_Win_flush_all(handle->win);
+        doorbell_ring(handle);
+        
+        for (int k = 0; k < run; k++) {
+            int rank = tail + k;
+            printf("Producer enqueued item for city %u at inbox %d slot %d (rank %d)\n",
+                   items[done + k].city_id, rank % inboxes, rank / inboxes % capacity, rank);
+        }
+        handle->tail += run;
+        done += run;
+    }
+    
+    return n;
+}
+
+// Move the head of inbox i from head to head + count, unless someone else
+// moved it first (inbox layout with stealing)
+static bool inbox_claim(FFQHandle* handle, int i, int head, int count) {
+    int next = head + count, previous;
+    int host = handle->first_host + i;
+    MPI_Compare_and_swap(&next, &head, &previous, MPI_INT, host, 
+                         offsetof(FFQInbox, head), handle->win);
+    MPI_Win_flush(host, handle->win);
+    return previous == head;
+}
+
+// OPTIMIZATION: Work stealing (inbox layout, options->steal). A consumer
+// with an empty inbox reads the head and tail of every other inbox in one
+// flush and takes up to half the backlog of the fullest: the items are
+// read first, then claimed by a compare-and-swap of the victim's head.
+// Owners advance their head the same way while stealing is on, so a failed
+// swap only means the items went elsewhere and the copies are dropped.
+// A sentinel ends the steal before it, so every consumer still receives
+// the sentinels dealt to its own inbox.
+static int inbox_steal(FFQHandle* handle, int consumer_id, WeatherRecord* out, int max) {
+    int inboxes = handle->inboxes;
+    int own = handle->local_rank - handle->first_host;
+    int heads[inboxes], tails[inboxes];
+    
+    for (int i = 0; i < inboxes; i++) {
+        if (i != own) {
+            MPI_Fetch_and_op(NULL, &heads[i], MPI_INT, handle->first_host + i, 
+                             offsetof(FFQInbox, head), MPI_NO_OP, handle->win);
+            MPI_Fetch_and_op(NULL, &tails[i], MPI_INT, handle->first_host + i, 
+                             offsetof(FFQInbox, tail), MPI_NO_OP, handle->win);
+        }
+    }
+    MPI_Win_flush_all(handle->win);
+    
+    // The two reads are not ordered: a head read last may have passed the
+    // tail, which only hides items until the next attempt
+    int victim = -1, backlog = 0;
+    for (int i = 0; i < inboxes; i++) {
+        if (i != own && tails[i] - heads[i] > backlog) {
+            victim = i;
+            backlog = tails[i] - heads[i];
+        }
+    }
+    if (victim < 0) {
+        return 0;
+    }
+    
+    int head = heads[victim];
+    int count = (backlog + 1) / 2 < max ? (backlog + 1) / 2 : max;
+    int slot = head % handle->segment_size;
+    int part = handle->segment_size - slot < count ? handle->segment_size - slot : count;
+    int host = handle->first_host + victim;
+    MPI_Get(out, part, handle->weather_type, host, offsetof(FFQInbox, items[slot]), 
+            part, handle->weather_type, handle->win);
+    if (part < count) {
+        MPI_Get(out + part, count - part, handle->weather_type, host, offsetof(FFQInbox, items[0]), 
+                count - part, handle->weather_type, handle->win);
+    }
+    MPI_Win_flush(host, handle->win);
+    
+    for (int k = 0; k < count; k++) {
+        if (out[k].flags & WEATHER_RECORD_SENTINEL) {
+            count = k;
+        }
+    }
+    if (count == 0 || !inbox_claim(handle, victim, head, count)) {
+        return 0;
+    }
+    
+    for (int k = 0; k < count; k++) {
+        printf("Consumer %d dequeued item for (timestamp %lld, city %u, aqi %d, wind_speed %f, humidity %u) stolen from inbox %d slot %d (rank %d)\n", 
+               consumer_id, (long long)out[k].timestamp_us, out[k].city_id, out[k].aqi, 
+               out[k].wind_speed, out[k].humidity, victim, (head + k) % handle->segment_size, 
+               (head + k) * inboxes + victim);
+    }
+    return count;
+}
+
+// Inbox layout: take up to max items from the own inbox. Only local memory
+// is read; Win_sync makes the producer's RMA updates visible to the loads.
+// With stealing, the head is claimed by compare-and-swap and an empty inbox
+// sends the consumer to the others. Without wait, an empty inbox yields nothing.
+static int ffq_dequeue_inbox(FFQHandle* handle, int consumer_id, WeatherRecord* out, int max, bool wait) {
+    FFQInbox* inbox = handle->inbox;
+    int inbox_id = handle->local_rank - handle->first_host;
+    int head, tail, count;
+    bool armed = false;
+    Waiter waiter;
+    waiter_init(&waiter, &handle->wait);
+    
+    while (true) {
+        MPI_Win_sync(handle->win);
+        head = atomic_load_explicit(ATOMIC_INT(inbox->head), memory_order_relaxed);
+        tail = atomic_load_explicit(ATOMIC_INT(inbox->tail), memory_order_acquire);
+        if (tail != head) {
+            count = tail - head < max ? tail - head : max;
+            for (int k = 0; k < count; k++) {
+                out[k] = inbox->items[(head + k) % handle->segment_size];
+            }
+            if (!handle->steal || inbox_claim(handle, inbox_id, head, count)) {
+                break;
+            }
+            continue; // A thief took some of them first
+        }
+        if (handle->lane && lane_take(handle, consumer_id, out)) {
+            return 1;
+        }
+        if (handle->steal && (count = inbox_steal(handle, consumer_id, out, max)) > 0) {
+            return count;
+        }
+        if (!wait) {
+            return 0;
+        }
+        consumer_wait(handle, &waiter, &armed, DBL_MAX);
+    }
+    
+    for (int k = 0; k < count; k++) {
+        int slot = (head + k) % handle->segment_size;
+        printf("Consumer %d dequeued item for (timestamp %lld, city %u, aqi %d, wind_speed %f, humidity %u) from cell %d (rank %d)\n", 
+               consumer_id, (long long)out[k].timestamp_us, out[k].city_id, out[k].aqi, 
+               out[k].wind_speed, out[k].humidity, slot, (head + k) * handle->inboxes + inbox_id);
+    }
+    
+    // Return the slots; the producer reads the head when it needs credit
+    if (!handle->steal) {
+        atomic_store_explicit(ATOMIC_INT(inbox->head), head + count, memory_order_release);
+        MPI_Win_sync(handle->win);
+    }
+    return count;
+}
+
+// Multi-producer enqueue (producers > 1). Every producer draws its rank
+// from the shared tail, so ranks stay unique and consumers run unchanged.
+// Producers now race for cells: a free cell is taken only if no producer
+// has published into it or marked it past our rank in the meantime, and a
+// busy cell gets our rank as gap only if that raises it. Otherwise the
+// rank is dropped (its consumer sees the gap) and a new one is drawn.
+//
+// Shared memory: the whole state word is compare-and-swapped. A claimed
+// cell holds CLAIMED_CELL as rank while the payload is written, which
+// keeps other producers out and consumers waiting.
+static bool ffq_enqueue_shared_mpmc(FFQHandle* handle, WeatherRecord item) {
+    FFQueue* queue = handle->queue;
+    Waiter waiter;
+    waiter_init(&waiter, &handle->wait);
+    
+    while (true) {
+        int rank = atomic_fetch_add_explicit(ATOMIC_INT(queue->tail), 1, memory_order_relaxed);
+        int idx = rank % handle->local_size;
+        _Atomic int64_t* state_word = ATOMIC_STATE(queue->cells[idx].state);
+        int64_t state = atomic_load_explicit(state_word, memory_order_acquire);
+        
+        // A failed CAS reloads state, so each pass decides on a fresh value
+        while (FFQ_STATE_GAP(state) < rank) {
+            if (FFQ_STATE_RANK(state) == EMPTY_CELL) {
+                int64_t claimed = FFQ_STATE(CLAIMED_CELL, FFQ_STATE_GAP(state));
+                if (atomic_compare_exchange_weak_explicit(state_word, &state, claimed,
+                                                          memory_order_acquire, memory_order_acquire)) {
+                    *FFQ_CELL_DATA(queue, idx) = item;
+                    atomic_fetch_xor_explicit(state_word, FFQ_RANK_FLIP(CLAIMED_CELL, rank),
+                                              memory_order_release);
+                    doorbell_ring(handle);
+                    
+                    handle->tail = rank + 1;
+                    printf("Producer enqueued item for city %u at cell %d (rank %d)\n",
+                           item.city_id, idx, rank);
+                    return true;
+                }
+            } else {
+                int64_t marked = FFQ_STATE(FFQ_STATE_RANK(state), rank);
+                if (atomic_compare_exchange_weak_explicit(state_word, &state, marked,
+                                                          memory_order_release, memory_order_acquire)) {
+                    break;
+                }
+            }
+        }
+        
+        printf("Producer skipped cell %d (rank %d)\n", idx, rank);
+        doorbell_ring(handle);
+        waiter_pause(&waiter);
+    }
+}
+
+// OPTIMIZATION: Over RMA a 64-bit compare-and-swap on the state word is
+// not used (some transports fail on a CAS that targets the caller's own
+// window); a producer instead holds the cell's 32-bit lock word while it
+// reads and updates the state. Consumers never take the lock: they only
+// flip the rank half, which the XOR updates below commute with.
+static void lock_cell(FFQHandle* handle, int idx, Waiter* waiter) {
+    const int locked = 1, unlocked = 0;
+    int host = cell_host(handle, idx);
+    while (true) {
+        int previous;
+        MPI_Compare_and_swap(&locked, &unlocked, &previous, MPI_INT, host, CELL_LOCK_DISP(handle, idx), handle->win);
+        MPI_Win_flush(host, handle->win);
+        if (previous == unlocked) {
+            return;
+        }
+        waiter_pause(waiter);
+    }
+}
+
+static void unlock_cell(FFQHandle* handle, int idx) {
+    const int unlocked = 0;
+    int host = cell_host(handle, idx);
+    MPI_Accumulate(&unlocked, 1, MPI_INT, host, CELL_LOCK_DISP(handle, idx), 1, MPI_INT, MPI_REPLACE, handle->win);
+    MPI_Win_flush(host, handle->win);
+}
+
+static bool ffq_enqueue_mpmc(FFQHandle* handle, WeatherRecord item) {
+    const int one = 1;
+    Waiter waiter;
+    waiter_init(&waiter, &handle->wait);
+    
+    while (true) {
+        int rank;
+        MPI_Fetch_and_op(&one, &rank, MPI_INT, 0, FFQ_FIELD_DISP(handle, tail), MPI_SUM, handle->win);
         MPI_Win_flush(0, handle->win);
         
-        if (cell_rank < 0) {
-            // Cell is free - OPTIMIZATION: Batch Put operations before flush
-            // Write data first
-            MPI_Put(&item, 1, handle->weather_type, 0, 
-                    offsetof(FFQueue, cells[idx].data), 
+        int idx = rank % handle->local_size;
+        int host = cell_host(handle, idx);
+        bool published = false;
+        
+        lock_cell(handle, idx, &waiter);
+        int64_t state = read_cell_state(handle, idx);
+        if (FFQ_STATE_GAP(state) < rank) {
+            if (FFQ_STATE_RANK(state) == EMPTY_CELL) {
+                MPI_Put(&item, 1, handle->weather_type, host,
+                        CELL_DATA_DISP(handle, idx),
+                        1, handle->weather_type, handle->win);
+                MPI_Win_flush(host, handle->win);
+                
+                int64_t flip = FFQ_RANK_FLIP(EMPTY_CELL, rank);
+                flip_cell_state(handle, idx, &flip);
+                published = true;
+            } else {
+                int64_t flip = FFQ_GAP_FLIP(FFQ_STATE_GAP(state), rank);
+                flip_cell_state(handle, idx, &flip);
+            }
+            MPI_Win_flush(host, handle->win);
+        }
+        unlock_cell(handle, idx);
+        doorbell_ring(handle);
+        
+        if (published) {
+            handle->tail = rank + 1;
+            printf("Producer enqueued item for city %u at cell %d (rank %d)\n",
+                   item.city_id, idx, rank);
+            return true;
+        }
+        printf("Producer skipped cell %d (rank %d)\n", idx, rank);
+        waiter_pause(&waiter);
+    }
+}
+
+bool ffq_enqueue(FFQHandle* handle, WeatherRecord item) {
+    if (handle->lane && item.aqi >= handle->priority_aqi && lane_has_room(handle)) {
+        bool success = ffq_enqueue(handle->lane, item);
+        doorbell_ring(handle); // Consumers sleep on the ring's doorbell
+        spend_credit(handle, 1);
+        return success;
+    }
+    if (handle->producers > 1) {
+        return handle->shared ? ffq_enqueue_shared_mpmc(handle, item) : ffq_enqueue_mpmc(handle, item);
+    }
+    if (handle->shared) {
+        return ffq_enqueue_shared(handle, item);
+    }
+    if (handle->layout == FFQ_LAYOUT_INBOX) {
+        return ffq_enqueue_inbox(handle, &item, 1) == 1;
+    }
+    
+    bool success = false;
+    bool skipped = false;
+    // OPTIMIZATION: The tail is producer-local, it only lives in the handle
+    int local_tail = handle->tail;
+    Waiter waiter;
+    waiter_init(&waiter, &handle->wait);
+    await_credit(handle);
+    
+    while (!success) {
+        int idx = local_tail % handle->local_size;
+        int host = cell_host(handle, idx);
+        
+        // OPTIMIZATION: rank and gap arrive together in one atomic read
+        int64_t state = read_cell_state(handle, idx);
+        
+        if (FFQ_STATE_RANK(state) < 0) {
+            // Cell is free - write data first and make it visible
+            // before the rank announces it to consumers
+            MPI_Put(&item, 1, handle->weather_type, host,
+                    CELL_DATA_DISP(handle, idx),
                     1, handle->weather_type, handle->win);
+            MPI_Win_flush(host, handle->win);
             
-            // Then update the rank to mark as used
-            MPI_Put(&local_tail, 1, MPI_INT, 0, 
-                    offsetof(FFQueue, cells[idx].rank), 
-                    1, MPI_INT, handle->win);
+            // Then publish the rank. Only the producer writes a free cell,
+            // so flipping the rank half leaves the gap untouched.
+            int64_t flip = FFQ_RANK_FLIP(EMPTY_CELL, local_tail);
+            flip_cell_state(handle, idx, &flip);
+            MPI_Win_flush(host, handle->win);
+            spend_credit(handle, 1);
             
-            // Update tail
             local_tail++;
-            MPI_Put(&local_tail, 1, MPI_INT, 0, 
-                    offsetof(FFQueue, tail), 
-                    1, MPI_INT, handle->win);
-            
-            // OPTIMIZATION: Single flush for all operations
-            MPI_Win_flush(0, handle->win);
             
             success = true;
-            printf("Producer enqueued item for city %s at cell %d (rank %d)\n", 
-                   item.city, idx, local_tail - 1);
+            printf("Producer enqueued item for city %u at cell %d (rank %d)\n",
+                   item.city_id, idx, local_tail - 1);
         } else {
-            // Cell is in use - mark as gap and update tail
-            MPI_Put(&local_tail, 1, MPI_INT, 0, 
-                    offsetof(FFQueue, cells[idx].gap), 
-                    1, MPI_INT, handle->win);
+            // Cell is in use - mark as gap. The consumer may clear the rank
+            // half concurrently, the XOR on the gap half commutes with it.
+            int64_t flip = FFQ_GAP_FLIP(FFQ_STATE_GAP(state), local_tail);
+            flip_cell_state(handle, idx, &flip);
+            MPI_Win_flush(host, handle->win);
             
             local_tail++;
-            MPI_Put(&local_tail, 1, MPI_INT, 0, 
-                    offsetof(FFQueue, tail), 
-                    1, MPI_INT, handle->win);
-            
-            // OPTIMIZATION: Batch flush
-            MPI_Win_flush(0, handle->win);
             
+            skipped = true;
             printf("Producer skipped cell %d (rank %d)\n", idx, local_tail - 1);
         }
+        doorbell_ring(handle);
         
-        MPI_Win_unlock(0, handle->win);
-        
-        // OPTIMIZATION: Adaptive backoff
         if (!success) {
-            usleep(backoff_us);
-            backoff_us = (backoff_us * 2 > MAX_BACKOFF) ? MAX_BACKOFF : backoff_us * 2;
+            waiter_pause(&waiter);
         }
     }
     
+    handle->tail = local_tail;
+    if (handle->max_size > 0) {
+        adapt_capacity(handle, 1, skipped);
+    }
     return success;
 }
 
-bool ffq_dequeue_optimized(FFQHandle* handle, int consumer_id, WeatherData* item) {
-    int fetch_rank = 0;
-    int backoff_us = 100;  // Adaptive backoff
-    const int MAX_BACKOFF = 10000;
+// OPTIMIZATION: Batched enqueue. The states of a run of consecutive cells
+// are read with one Get_accumulate, the payloads of its free prefix are
+// written with one contiguous Put and published with one Accumulate, so the
+// whole run costs three flushes instead of two per item. Runs hold at most
+// ENQUEUE_BATCH_SIZE cells, so larger batches go in several of them.
+static int enqueue_ring_batch(FFQHandle* handle, const WeatherRecord* items, int n) {
+    if (handle->producers > 1) {
+        // Every item draws its own rank from the shared tail
+        for (int i = 0; i < n; i++) {
+            ffq_enqueue(handle, items[i]);
+        }
+        return n;
+    }
+    if (handle->shared) {
+        for (int i = 0; i < n; i++) {
+            ffq_enqueue_shared(handle, items[i]);
+        }
+        return n;
+    }
+    if (handle->layout == FFQ_LAYOUT_INBOX) {
+        return ffq_enqueue_inbox(handle, items, n);
+    }
     
-    // OPTIMIZATION: Use compare-and-swap pattern for atomic fetch-and-increment
-    // This is more efficient than Get_accumulate in many implementations
-    MPI_Win_lock(MPI_LOCK_EXCLUSIVE, 0, 0, handle->win);
-    MPI_Get_accumulate(&(int){1}, 1, MPI_INT, 
-                      &fetch_rank, 1, MPI_INT, 
-                      0, offsetof(FFQueue, head), 1, 
-                      MPI_INT, MPI_SUM, handle->win);
-    MPI_Win_flush(0, handle->win);
-    MPI_Win_unlock(0, handle->win);
+    int local_tail = handle->tail;
+    int done = 0;
+    bool skipped = false;
+    Waiter waiter;
+    waiter_init(&waiter, &handle->wait);
+    int64_t states[ENQUEUE_BATCH_SIZE];
     
-    int idx = fetch_rank % handle->local_size;
-    bool success = false;
-    int retry_count = 0;
-    const int MAX_RETRIES = 1000;  // Prevent infinite loops
-    
-    while (!success && retry_count < MAX_RETRIES) {
-        retry_count++;
-        
-        // OPTIMIZATION: Use shared lock for reading, reduces contention
-        MPI_Win_lock(MPI_LOCK_SHARED, 0, 0, handle->win);
-        
-        // OPTIMIZATION: Batch all Get operations together
-        int cell_rank, cell_gap, lastItem;
-        WeatherData cell_data;
-        
-        MPI_Get(&cell_rank, 1, MPI_INT, 0, 
-                offsetof(FFQueue, cells[idx].rank), 
-                1, MPI_INT, handle->win);
-        MPI_Get(&cell_gap, 1, MPI_INT, 0, 
-                offsetof(FFQueue, cells[idx].gap), 
-                1, MPI_INT, handle->win);
-        MPI_Get(&cell_data, 1, handle->weather_type, 0, 
-                offsetof(FFQueue, cells[idx].data), 
-                1, handle->weather_type, handle->win);
-        MPI_Get(&lastItem, 1, MPI_INT, 0, 
-                offsetof(FFQueue, lastItemDequeued), 
-                1, MPI_INT, handle->win);
-        
-        // OPTIMIZATION: Single flush for all Get operations
-        MPI_Win_flush(0, handle->win);
-        MPI_Win_unlock(0, handle->win);
+    while (done < n) {
+        int idx = local_tail % handle->local_size;
+        int host = cell_host(handle, idx);
         
-        if (cell_rank == fetch_rank) {
-            // Item found, dequeue it
-            *item = cell_data;
+        // A run never wraps around the end of the ring or leaves a
+        // segment, nor goes beyond the credit or the states buffer
+        int run = n - done < ENQUEUE_BATCH_SIZE ? n - done : ENQUEUE_BATCH_SIZE;
+        if (run > cell_run(handle, idx)) {
+            run = cell_run(handle, idx);
+        }
+        if (handle->credit >= 0) {
+            await_credit(handle);
+            if (run > handle->credit) {
+                run = handle->credit;
+            }
+        }
+        
+        // Atomically read the state of every cell in the run
+        MPI_Get_accumulate(NULL, 0, MPI_INT64_T, 
+                           states, run, MPI_INT64_T, 
+                           host, CELL_STATE_DISP(handle, idx), 
+                           run, handle->cell_state_type, MPI_NO_OP, handle->win);
+        MPI_Win_flush(host, handle->win);
+        
+        int free_cells = 0;
+        while (free_cells < run && FFQ_STATE_RANK(states[free_cells]) < 0) {
+            free_cells++;
+        }
+        
+        if (free_cells == 0) {
+            // First cell is in use - mark as gap and move on, as ffq_enqueue
+            int64_t flip = FFQ_GAP_FLIP(FFQ_STATE_GAP(states[0]), local_tail);
+            flip_cell_state(handle, idx, &flip);
+            MPI_Win_flush(host, handle->win);
+            doorbell_ring(handle);
             
-            // OPTIMIZATION: Exclusive lock only for write operations
-            MPI_Win_lock(MPI_LOCK_EXCLUSIVE, 0, 0, handle->win);
+            local_tail++;
+            skipped = true;
             
-            // Batch Put operations
-            int empty = EMPTY_CELL;
-            int new_last = lastItem + 1;
+            printf("Producer skipped cell %d (rank %d)\n", idx, local_tail - 1);
             
-            MPI_Put(&empty, 1, MPI_INT, 0, 
-                    offsetof(FFQueue, cells[idx].rank), 
-                    1, MPI_INT, handle->win);
-            MPI_Put(&new_last, 1, MPI_INT, 0, 
-                    offsetof(FFQueue, lastItemDequeued), 
-                    1, MPI_INT, handle->win);
+            waiter_pause(&waiter);
+            continue;
+        }
+        
+        // Write all payloads of the free prefix at once (contiguous in the
+        // payload array)
+        MPI_Put(&items[done], free_cells, handle->weather_type, host, 
+                CELL_DATA_DISP(handle, idx), 
+                free_cells, handle->weather_type, handle->win);
+        MPI_Win_flush(host, handle->win);
+        
+        // Then publish their ranks, flipping only the rank half of each state
+        for (int i = 0; i < free_cells; i++) {
+            states[i] = FFQ_RANK_FLIP(EMPTY_CELL, local_tail + i);
+        }
+        MPI_Accumulate(states, free_cells, MPI_INT64_T, host, 
+                       CELL_STATE_DISP(handle, idx), 
+                       free_cells, handle->cell_state_type, MPI_BXOR, handle->win);
+        MPI_Win_flush(host, handle->win);
+        doorbell_ring(handle);
+        spend_credit(handle, free_cells);
+        
+        local_tail += free_cells;
+        
+        for (int i = 0; i < free_cells; i++) {
+            printf("Producer enqueued item for city %u at cell %d (rank %d)\n", 
+                   items[done + i].city_id, idx + i, local_tail - free_cells + i);
+        }
+        
+        done += free_cells;
+        waiter_reset(&waiter);
+    }
+    
+    handle->tail = local_tail;
+    if (handle->max_size > 0) {
+        adapt_capacity(handle, done, skipped);
+    }
+    return done;
+}
+
+// Priority records go through the lane one by one, the runs of other
+// records between them through the ring's batched path
+int ffq_enqueue_batch(FFQHandle* handle, const WeatherRecord* items, int n) {
+    if (handle->lane == NULL) {
+        return enqueue_ring_batch(handle, items, n);
+    }
+    
+    int count = 0;
+    for (int i = 0; i < n; ) {
+        int run = 0;
+        while (i + run < n && items[i + run].aqi < handle->priority_aqi) {
+            run++;
+        }
+        if (run == 0) {
+            count += ffq_enqueue(handle, items[i]) ? 1 : 0;
+            i++;
+        } else {
+            count += enqueue_ring_batch(handle, items + i, run);
+            i += run;
+        }
+    }
+    return count;
+}
+
+// Dequeue one item. Without wait, returns false instead of waiting for the
+// producer and keeps the claimed rank for the next call.
+static bool dequeue(FFQHandle* handle, int consumer_id, WeatherRecord* item, bool wait) {
+    if (handle->shared) {
+        return ffq_dequeue_shared(handle, consumer_id, item, wait);
+    }
+    if (handle->layout == FFQ_LAYOUT_INBOX) {
+        // Inbox items are the consumer's own, so the lane is looked at first
+        if (handle->lane && lane_take(handle, consumer_id, item)) {
+            return true;
+        }
+        return ffq_dequeue_inbox(handle, consumer_id, item, 1, wait) == 1;
+    }
+    
+    int fetch_rank = handle->pending;
+    const int one = 1;
+    bool armed = false;  // Doorbell armed since the last look at the cell
+    Waiter waiter;
+    waiter_init(&waiter, &handle->wait);
+    
+    // OPTIMIZATION: Claim a rank with a single atomic round trip inside the
+    // persistent epoch instead of an exclusive lock on rank 0. A rank left
+    // for a priority item by the previous call is resumed instead.
+    if (fetch_rank < 0) {
+        MPI_Fetch_and_op(&one, &fetch_rank, MPI_INT, 0, 
+                         FFQ_FIELD_DISP(handle, head), MPI_SUM, handle->win);
+        MPI_Win_flush(0, handle->win);
+    }
+    handle->pending = -1;
+    
+    int idx = rank_cell(handle, fetch_rank);
+    int64_t capacity = handle->capacity;
+    bool success = false;
+    double deadline = MPI_Wtime() + FFQ_DEQUEUE_TIMEOUT_S;
+    
+    while (!success) {
+        
+        // OPTIMIZATION: A resizable ring's capacity word rides along with
+        // the state read. The flush may complete it before the state, so it
+        // only tells where to look until it is read again after a gap.
+        if (handle->max_size > 0) {
+            MPI_Fetch_and_op(NULL, &capacity, MPI_INT64_T, 0, 
+                             FFQ_FIELD_DISP(handle, capacity), MPI_NO_OP, handle->win);
+        }
+        
+        // OPTIMIZATION: Rank and gap come from one atomic read of the state
+        // word. The payload is fetched only after the rank matches, because
+        // without an exclusive lock it may still be in flight before that.
+        int64_t state = read_cell_state(handle, idx);
+        int cell_rank = FFQ_STATE_RANK(state);
+        int cell_gap = FFQ_STATE_GAP(state);
+        bool skipped = cell_gap >= fetch_rank && cell_rank != fetch_rank;
+        
+        if (handle->max_size > 0 && cell_rank != fetch_rank) {
+            if (skipped) {
+                // A gap only counts where the producer put the rank
+                MPI_Fetch_and_op(NULL, &capacity, MPI_INT64_T, 0, 
+                                 FFQ_FIELD_DISP(handle, capacity), MPI_NO_OP, handle->win);
+                MPI_Win_flush(0, handle->win);
+            }
+            handle->capacity = capacity;
+            int cell = fetch_rank % ring_size(handle, capacity, fetch_rank);
+            if (cell != idx) {
+                idx = cell;
+                continue;
+            }
+        }
+        
+        if (handle->lane && !skipped && lane_take(handle, consumer_id, item)) {
+            // A priority item overtakes the claimed rank, kept for the next call
+            handle->pending = fetch_rank;
+            success = true;
+        }
+        else if (cell_rank == fetch_rank) {
+            // Item found, dequeue it
+            int host = cell_host(handle, idx);
+            MPI_Get(item, 1, handle->weather_type, host, 
+                    CELL_DATA_DISP(handle, idx), 
+                    1, handle->weather_type, handle->win);
+            if (handle->max_size > 0) {
+                // Read after the state, to resolve the rank in its generation
+                MPI_Fetch_and_op(NULL, &capacity, MPI_INT64_T, 0, 
+                                 FFQ_FIELD_DISP(handle, capacity), MPI_NO_OP, handle->win);
+            }
+            MPI_Win_flush(host, handle->win);
+            
+            // Recycle the cell and bump the dequeue counter. The producer may
+            // move the gap meanwhile, so only the rank half is flipped.
+            int64_t flip = FFQ_RANK_FLIP(fetch_rank, EMPTY_CELL);
+            flip_cell_state(handle, idx, &flip);
+            MPI_Accumulate(&one, 1, MPI_INT, 0, 
+                           FFQ_FIELD_DISP(handle, lastItemDequeued), 
+                           1, MPI_INT, MPI_SUM, handle->win);
+            if (handle->max_size > 0) {
+                handle->capacity = capacity;
+                resolve_rank(handle, capacity, fetch_rank);
+            }
             
             // OPTIMIZATION: Single flush for both operations
-            MPI_Win_flush(0, handle->win);
-            MPI_Win_unlock(0, handle->win);
+            flush_queue(handle);
             
             success = true;
-            printf("Consumer %d dequeued item for (timestamp %s, city %s, aqi %d, wind_speed %f, humidity %d) from cell %d (rank %d)\n", 
-                   consumer_id, item->timestamp, item->city, item->aqi, item->wind_speed, item->humidity, idx, fetch_rank);
+            printf("Consumer %d dequeued item for (timestamp %lld, city %u, aqi %d, wind_speed %f, humidity %u) from cell %d (rank %d)\n", 
+                   consumer_id, (long long)item->timestamp_us, item->city_id, item->aqi, item->wind_speed, item->humidity, idx, fetch_rank);
         } 
-        else if (cell_gap >= fetch_rank && cell_rank != fetch_rank) {
+        else if (skipped) {
             // Cell was skipped, move to next rank
-            MPI_Win_lock(MPI_LOCK_EXCLUSIVE, 0, 0, handle->win);
-            MPI_Get_accumulate(&(int){1}, 1, MPI_INT, 
-                              &fetch_rank, 1, MPI_INT, 
-                              0, offsetof(FFQueue, head), 1, 
-                              MPI_INT, MPI_SUM, handle->win);
+            if (handle->max_size > 0) {
+                resolve_rank(handle, capacity, fetch_rank);
+            }
+            MPI_Fetch_and_op(&one, &fetch_rank, MPI_INT, 0, 
+                             FFQ_FIELD_DISP(handle, head), MPI_SUM, handle->win);
             MPI_Win_flush(0, handle->win);
-            MPI_Win_unlock(0, handle->win);
             
-            idx = fetch_rank % handle->local_size;
+            idx = rank_cell(handle, fetch_rank);
             printf("Consumer %d skipped to rank %d (cell %d)\n", 
                    consumer_id, fetch_rank, idx);
-            
-            // Reset backoff on progress
-            backoff_us = 100;
         } 
+        else if (!wait || MPI_Wtime() >= deadline) {
+            // The deadline is only honoured after a look at the cell, and
+            // the rank is kept so that its item is not lost
+            if (wait) {
+                fprintf(stderr, "Consumer %d: Dequeue timeout after %.0f s\n", 
+                        consumer_id, FFQ_DEQUEUE_TIMEOUT_S);
+            }
+            handle->pending = fetch_rank;
+            return false;
+        }
         else {
-            // Wait for producer to write data - OPTIMIZATION: Adaptive backoff
-            usleep(backoff_us);
-            backoff_us = (backoff_us * 2 > MAX_BACKOFF) ? MAX_BACKOFF : backoff_us * 2;
+            // Producer has not written the cell yet
+            consumer_wait(handle, &waiter, &armed, deadline);
         }
     }
     
-    if (!success && retry_count >= MAX_RETRIES) {
-        fprintf(stderr, "Consumer %d: Dequeue timeout after %d retries\n", 
-                consumer_id, retry_count);
+    return success;
+}
+
+bool ffq_dequeue(FFQHandle* handle, int consumer_id, WeatherRecord* item) {
+    return dequeue(handle, consumer_id, item, true);
+}
+
+bool ffq_try_dequeue(FFQHandle* handle, int consumer_id, WeatherRecord* item) {
+    return dequeue(handle, consumer_id, item, false);
+}
+
+// Atomically read the state words of the cells holding ranks
+// [first, first + count). The range is split where it wraps the ring or
+// crosses into another rank's segment; all pieces complete in one flush.
+static void fetch_cell_state(FFQHandle* handle, int first, int count, int64_t* states) {
+    for (int done = 0; done < count; ) {
+        int idx = (first + done) % handle->local_size;
+        int part = cell_run(handle, idx) < count - done ? cell_run(handle, idx) : count - done;
+        
+        MPI_Get_accumulate(NULL, 0, MPI_INT64_T, states + done, part, MPI_INT64_T, 
+                           cell_host(handle, idx), CELL_STATE_DISP(handle, idx), 
+                           part, handle->cell_state_type, MPI_NO_OP, handle->win);
+        done += part;
+    }
+    flush_queue(handle);
+}
+
+// Read the payloads of the cells holding ranks [first, first + count)
+static void fetch_cell_data(FFQHandle* handle, int first, int count, WeatherRecord* out) {
+    for (int done = 0; done < count; ) {
+        int idx = (first + done) % handle->local_size;
+        int part = cell_run(handle, idx) < count - done ? cell_run(handle, idx) : count - done;
+        
+        MPI_Get(out + done, part, handle->weather_type, cell_host(handle, idx), 
+                CELL_DATA_DISP(handle, idx), 
+                part, handle->weather_type, handle->win);
+        done += part;
+    }
+    flush_queue(handle);
+}
+
+// Start a new batch of count ranks claimed from first
+static void batch_start(FFQHandle* handle, int first, int count) {
+    handle->batch_first = first;
+    handle->batch_count = count;
+    for (int i = 0; i < count; i++) {
+        handle->batch_done[i] = false;
     }
+}
+
+// Drop the resolved ranks at the front of the batch, so that only the
+// first unresolved rank and those after it are kept for the next call
+static void batch_trim(FFQHandle* handle) {
+    int done = 0;
+    while (done < handle->batch_count && handle->batch_done[done]) {
+        done++;
+    }
+    memmove(handle->batch_done, handle->batch_done + done, 
+            (handle->batch_count - done) * sizeof(bool));
+    handle->batch_first += done;
+    handle->batch_count -= done;
+}
+
+// Ranks a new batch claims: never more than the ring has cells, which
+// would map two ranks onto one cell
+static int batch_size(const FFQHandle* handle, int max) {
+    int k = max < DEQUEUE_BATCH_SIZE ? max : DEQUEUE_BATCH_SIZE;
+    return k < handle->local_size ? k : handle->local_size;
+}
+
+// Shared-memory batch dequeue: one atomic_fetch_add claims all ranks
+static int ffq_dequeue_batch_shared(FFQHandle* handle, int consumer_id, WeatherRecord* out, int max) {
+    FFQueue* queue = handle->queue;
+    int count = 0;
+    bool armed = false;
+    Waiter waiter;
+    waiter_init(&waiter, &handle->wait);
+    double deadline = MPI_Wtime() + FFQ_DEQUEUE_TIMEOUT_S;
     
-    return success;
+    while (count == 0) {
+        if (handle->batch_count == 0) {
+            int k = batch_size(handle, max);
+            batch_start(handle, atomic_fetch_add_explicit(ATOMIC_INT(queue->head), k, memory_order_relaxed), k);
+        }
+        
+        bool waiting = false;
+        for (int i = 0; i < handle->batch_count && count < max; i++) {
+            if (handle->batch_done[i]) {
+                continue;
+            }
+            int claimed = handle->batch_first + i;
+            int idx = claimed % handle->local_size;
+            _Atomic int64_t* state_word = ATOMIC_STATE(queue->cells[idx].state);
+            int64_t state = atomic_load_explicit(state_word, memory_order_acquire);
+            
+            if (FFQ_STATE_RANK(state) == claimed) {
+                out[count++] = *FFQ_CELL_DATA(queue, idx);
+                atomic_fetch_xor_explicit(state_word, FFQ_RANK_FLIP(claimed, EMPTY_CELL), 
+                                          memory_order_release);
+                atomic_fetch_add_explicit(ATOMIC_INT(queue->lastItemDequeued), 1, memory_order_relaxed);
+                handle->batch_done[i] = true;
+                printf("Consumer %d dequeued item for (timestamp %lld, city %u, aqi %d, wind_speed %f, humidity %u) from cell %d (rank %d)\n", 
+                       consumer_id, (long long)out[count - 1].timestamp_us, out[count - 1].city_id, out[count - 1].aqi, 
+                       out[count - 1].wind_speed, out[count - 1].humidity, idx, claimed);
+            } else if (FFQ_STATE_GAP(state) >= claimed) {
+                handle->batch_done[i] = true;
+                printf("Consumer %d skipped rank %d (cell %d)\n", consumer_id, claimed, idx);
+            } else {
+                waiting = true;
+            }
+        }
+        batch_trim(handle);
+        
+        // A batch made only of gaps is claimed again right away. The
+        // deadline is only honoured after a look at the cells.
+        if (count == 0 && waiting) {
+            if (MPI_Wtime() >= deadline) {
+                fprintf(stderr, "Consumer %d: Batch dequeue timeout after %.0f s\n", 
+                        consumer_id, FFQ_DEQUEUE_TIMEOUT_S);
+                break;
+            }
+            consumer_wait(handle, &waiter, &armed, deadline);
+        }
+    }
+    
+    return count;
+}
+
+// OPTIMIZATION: Batched dequeue. One Fetch_and_op claims a run of
+// consecutive ranks, their metadata is polled with one strided read and the
+// payloads of all cells that became ready are fetched with one Get. Each
+// rank is resolved on its own: taken when written, dropped when the
+// producer left a gap there, polled again otherwise. The call returns once
+// it took an item; unresolved ranks stay in the handle for the next call.
+// Items are returned in rank order.
+int ffq_dequeue_batch(FFQHandle* handle, int consumer_id, WeatherRecord* out, int max) {
+    if (max <= 0) {
+        return 0;
+    }
+    if (handle->max_size > 0) {
+        // Claimed ranks may straddle a change of capacity
+        return ffq_dequeue(handle, consumer_id, out) ? 1 : 0;
+    }
+    if (handle->lane) {
+        // Priority items first, then a rank the last call left pending
+        int count = 0;
+        while (count < max && lane_take(handle, consumer_id, &out[count])) {
+            count++;
+        }
+        if (count > 0) {
+            return count;
+        }
+        if (handle->pending >= 0) {
+            return ffq_dequeue(handle, consumer_id, out) ? 1 : 0;
+        }
+    }
+    if (handle->layout == FFQ_LAYOUT_INBOX) {
+        return ffq_dequeue_inbox(handle, consumer_id, out, max, true);
+    }
+    if (handle->shared) {
+        return ffq_dequeue_batch_shared(handle, consumer_id, out, max);
+    }
+    
+    int64_t states[DEQUEUE_BATCH_SIZE];
+    int64_t flips[DEQUEUE_BATCH_SIZE];
+    WeatherRecord fetched[DEQUEUE_BATCH_SIZE];
+    
+    int count = 0;
+    bool armed = false;  // Doorbell armed since the last look at the cells
+    Waiter waiter;
+    waiter_init(&waiter, &handle->wait);
+    double deadline = MPI_Wtime() + FFQ_DEQUEUE_TIMEOUT_S;
+    
+    while (count == 0) {
+        if (handle->batch_count == 0) {
+            int k = batch_size(handle, max);
+            int first = 0;
+            MPI_Fetch_and_op(&k, &first, MPI_INT, 0, 
+                             FFQ_FIELD_DISP(handle, head), MPI_SUM, handle->win);
+            MPI_Win_flush(0, handle->win);
+            batch_start(handle, first, k);
+        }
+        
+        int first = handle->batch_first;
+        int k = handle->batch_count;
+        bool* done = handle->batch_done;
+        fetch_cell_state(handle, first, k, states);
+        
+        // Resolve what can be resolved and find the span of ready cells,
+        // up to the max items the caller has room for
+        int lo = k, hi = -1, ready = 0;
+        bool waiting = false;
+        for (int i = 0; i < k; i++) {
+            if (done[i]) {
+                continue;
+            }
+            if (FFQ_STATE_RANK(states[i]) == first + i) {
+                if (ready < max) {
+                    lo = i < lo ? i : lo;
+                    hi = i;
+                    ready++;
+                }
+            } else if (FFQ_STATE_GAP(states[i]) >= first + i) {
+                done[i] = true;
+                printf("Consumer %d skipped rank %d (cell %d)\n", 
+                       consumer_id, first + i, (first + i) % handle->local_size);
+            } else {
+                waiting = true;
+            }
+        }
+        
+        if (hi >= lo) {
+            // Ranks were published after their data, so it is safe to read now
+            fetch_cell_data(handle, first + lo, hi - lo + 1, fetched + lo);
+            
+            // Recycle every taken cell by flipping its rank half, all
+            // completed by one flush of the queue
+            for (int i = lo; i <= hi; i++) {
+                if (!done[i] && FFQ_STATE_RANK(states[i]) == first + i) {
+                    int idx = (first + i) % handle->local_size;
+                    out[count++] = fetched[i];
+                    done[i] = true;
+                    flips[i] = FFQ_RANK_FLIP(first + i, EMPTY_CELL);
+                    flip_cell_state(handle, idx, &flips[i]);
+                    printf("Consumer %d dequeued item for (timestamp %lld, city %u, aqi %d, wind_speed %f, humidity %u) from cell %d (rank %d)\n", 
+                           consumer_id, (long long)fetched[i].timestamp_us, fetched[i].city_id, fetched[i].aqi, 
+                           fetched[i].wind_speed, fetched[i].humidity, idx, first + i);
+                }
+            }
+            MPI_Accumulate(&count, 1, MPI_INT, 0, 
+                           FFQ_FIELD_DISP(handle, lastItemDequeued), 
+                           1, MPI_INT, MPI_SUM, handle->win);
+            flush_queue(handle);
+        }
+        batch_trim(handle);
+        
+        // A batch made only of gaps is claimed again right away. The
+        // deadline is only honoured after a look at the cells.
+        if (count == 0 && waiting) {
+            if (MPI_Wtime() >= deadline) {
+                fprintf(stderr, "Consumer %d: Batch dequeue timeout after %.0f s\n", 
+                        consumer_id, FFQ_DEQUEUE_TIMEOUT_S);
+                break;
+            }
+            consumer_wait(handle, &waiter, &armed, deadline);
+        }
+    }
+    
+    return count;
+}
+
+// OPTIMIZATION: Request-based enqueue and dequeue. Every step that waits
+// on a round trip (claiming a rank, reading a cell's state, moving the
+// payload) is one request-based RMA operation, so it stays in flight while
+// the caller works and ffq_test only checks its completion. Recycling a
+// cell or publishing a rank still ends in a flush, issued once the payload
+// has been moved, when little is left to wait for. Shared memory has no
+// round trip to hide and inbox consumers read local memory; resizable and
+// multi-producer enqueues need several dependent round trips per rank.
+// Requests there fall back to ffq_try_dequeue and ffq_enqueue.
+enum { REQUEST_SYNC, REQUEST_CLAIM, REQUEST_POLL, REQUEST_FETCH, REQUEST_WRITE };
+
+// Whether requests on the queue run as RMA steps
+static bool request_async(const FFQHandle* handle) {
+    return !handle->shared && handle->layout != FFQ_LAYOUT_INBOX && handle->max_size == 0;
+}
+
+// Claim the next rank of the ring for a dequeue request
+static void request_claim(FFQRequest* request) {
+    static const int one = 1;
+    FFQHandle* handle = request->handle;
+    request->step = REQUEST_CLAIM;
+    MPI_Rget_accumulate(&one, 1, MPI_INT, &request->rank, 1, MPI_INT, 
+                        0, FFQ_FIELD_DISP(handle, head), 1, MPI_INT, 
+                        MPI_SUM, handle->win, &request->rma);
+}
+
+// Atomically read the state of the cell of the request's rank
+static void request_poll(FFQRequest* request) {
+    FFQHandle* handle = request->handle;
+    int idx = request->rank % handle->local_size;
+    request->step = REQUEST_POLL;
+    MPI_Rget_accumulate(NULL, 0, MPI_INT64_T, &request->state, 1, MPI_INT64_T, 
+                        cell_host(handle, idx), CELL_STATE_DISP(handle, idx), 
+                        1, MPI_INT64_T, MPI_NO_OP, handle->win, &request->rma);
+}
+
+// Act on the completed operation of request and start the next one, if
+// any. Returns false when the cell was not ready: nothing is in flight
+// then, and the caller polls again after its wait.
+static bool request_step(FFQRequest* request) {
+    static const int one = 1;
+    FFQHandle* handle = request->handle;
+    int idx = request->rank % handle->local_size;
+    int host = cell_host(handle, idx);
+    bool enqueue = request->out == NULL;
+    int64_t flip;
+    
+    switch (request->step) {
+    case REQUEST_CLAIM:
+        request_poll(request);
+        return true;
+        
+    case REQUEST_POLL:
+        if (enqueue && FFQ_STATE_RANK(request->state) < 0) {
+            request->step = REQUEST_WRITE;
+            MPI_Rput(&request->item, 1, handle->weather_type, host, 
+                     CELL_DATA_DISP(handle, idx), 
+                     1, handle->weather_type, handle->win, &request->rma);
+            return true;
+        }
+        if (enqueue) {
+            // Cell is in use - mark as gap and try the next rank, as ffq_enqueue
+            flip = FFQ_GAP_FLIP(FFQ_STATE_GAP(request->state), request->rank);
+            flip_cell_state(handle, idx, &flip);
+            MPI_Win_flush(host, handle->win);
+            doorbell_ring(handle);
+            printf("Producer skipped cell %d (rank %d)\n", idx, request->rank);
+            request->rank = ++handle->tail;
+            return false;
+        }
+        if (FFQ_STATE_RANK(request->state) == request->rank) {
+            // Published after its data, so the payload can be read now
+            request->step = REQUEST_FETCH;
+            MPI_Rget(request->out, 1, handle->weather_type, host, 
+                     CELL_DATA_DISP(handle, idx), 
+                     1, handle->weather_type, handle->win, &request->rma);
+            return true;
+        }
+        if (FFQ_STATE_GAP(request->state) >= request->rank) {
+            printf("Consumer %d skipped rank %d (cell %d)\n", 
+                   request->consumer_id, request->rank, idx);
+            request_claim(request);
+            return true;
+        }
+        return false;
+        
+    case REQUEST_FETCH:
+        // Recycle the cell and bump the dequeue counter, as ffq_dequeue
+        flip = FFQ_RANK_FLIP(request->rank, EMPTY_CELL);
+        flip_cell_state(handle, idx, &flip);
+        MPI_Accumulate(&one, 1, MPI_INT, 0, 
+                       FFQ_FIELD_DISP(handle, lastItemDequeued), 
+                       1, MPI_INT, MPI_SUM, handle->win);
+        flush_queue(handle);
+        
+        request->success = true;
+        request->done = true;
+        printf("Consumer %d dequeued item for (timestamp %lld, city %u, aqi %d, wind_speed %f, humidity %u) from cell %d (rank %d)\n", 
+               request->consumer_id, (long long)request->out->timestamp_us, request->out->city_id, 
+               request->out->aqi, request->out->wind_speed, request->out->humidity, idx, request->rank);
+        return true;
+        
+    case REQUEST_WRITE:
+        // The Rput has completed locally only: flush it to the cell before
+        // the rank announces it
+        MPI_Win_flush(host, handle->win);
+        flip = FFQ_RANK_FLIP(EMPTY_CELL, request->rank);
+        flip_cell_state(handle, idx, &flip);
+        MPI_Win_flush(host, handle->win);
+        doorbell_ring(handle);
+        spend_credit(handle, 1);
+        
+        handle->tail = request->rank + 1;
+        request->success = true;
+        request->done = true;
+        printf("Producer enqueued item for city %u at cell %d (rank %d)\n", 
+               request->item.city_id, idx, request->rank);
+        return true;
+    }
+    return true;
+}
+
+void ffq_ienqueue(FFQHandle* handle, WeatherRecord item, FFQRequest* request) {
+    request->handle = handle;
+    request->rma = MPI_REQUEST_NULL;
+    request->consumer_id = -1;
+    request->item = item;
+    request->out = NULL;
+    request->done = false;
+    request->success = false;
+    
+    bool priority = handle->lane && item.aqi >= handle->priority_aqi;
+    if (priority || handle->producers > 1 || !request_async(handle)) {
+        request->step = REQUEST_SYNC;
+        request->success = ffq_enqueue(handle, item);
+        request->done = true;
+        return;
+    }
+    
+    // The tail is producer-local and only moves when the request completes
+    await_credit(handle);
+    request->rank = handle->tail;
+    request_poll(request);
+}
+
+void ffq_idequeue(FFQHandle* handle, int consumer_id, WeatherRecord* item, FFQRequest* request) {
+    request->handle = handle;
+    request->rma = MPI_REQUEST_NULL;
+    request->consumer_id = consumer_id;
+    request->out = item;
+    request->done = false;
+    request->success = false;
+    
+    if (!request_async(handle)) {
+        request->step = REQUEST_SYNC;
+        return;
+    }
+    if (handle->lane && lane_take(handle, consumer_id, item)) {
+        request->success = true;
+        request->done = true;
+        return;
+    }
+    
+    // A rank left pending by an earlier dequeue is resumed first
+    if (handle->pending >= 0) {
+        request->rank = handle->pending;
+        handle->pending = -1;
+        request_poll(request);
+    } else {
+        request_claim(request);
+    }
+}
+
+bool ffq_test(FFQRequest* request) {
+    if (request->step == REQUEST_SYNC) {
+        if (!request->done && ffq_try_dequeue(request->handle, request->consumer_id, request->out)) {
+            request->success = true;
+            request->done = true;
+        }
+        return request->done;
+    }
+    
+    // Run every step whose operation has completed; a cell that was not
+    // ready is polled again, to be looked at by the next test
+    int completed = 1;
+    while (!request->done && completed) {
+        MPI_Test(&request->rma, &completed, MPI_STATUS_IGNORE);
+        if (completed && !request_step(request)) {
+            request_poll(request);
+            break;
+        }
+    }
+    return request->done;
+}
+
+bool ffq_wait(FFQRequest* request) {
+    FFQHandle* handle = request->handle;
+    if (request->step == REQUEST_SYNC) {
+        if (!request->done) {
+            request->success = ffq_dequeue(handle, request->consumer_id, request->out);
+            request->done = true;
+        }
+        return request->success;
+    }
+    
+    bool enqueue = request->out == NULL;
+    bool armed = false;  // Doorbell armed since the last look at the cell
+    Waiter waiter;
+    waiter_init(&waiter, &handle->wait);
+    double deadline = MPI_Wtime() + FFQ_DEQUEUE_TIMEOUT_S;
+    
+    while (!request->done) {
+        MPI_Wait(&request->rma, MPI_STATUS_IGNORE);
+        if (request_step(request)) {
+            continue;
+        }
+        if (!enqueue && MPI_Wtime() >= deadline && handle->pending < 0) {
+            // Keep the claim for a later dequeue, as ffq_try_dequeue does.
+            // While another claim is kept the request waits on, since its
+            // rank has nowhere to go.
+            fprintf(stderr, "Consumer %d: Dequeue timeout after %.0f s\n", 
+                    request->consumer_id, FFQ_DEQUEUE_TIMEOUT_S);
+            handle->pending = request->rank;
+            request->done = true;
+            break;
+        }
+        
+        // Waiting happens with nothing in flight, so an armed doorbell is
+        // always followed by a fresh look at the cell
+        if (enqueue) {
+            waiter_pause(&waiter);
+        } else {
+            consumer_wait(handle, &waiter, &armed, deadline);
+        }
+        request_poll(request);
+    }
+    return request->success;
 }
@@ -0,0 +1,50 @@
+#include "ffq_prefetch.h"
+#include <stdlib.h>
+
+FFQPrefetch* ffq_prefetch_create(FFQHandle* handle, int consumer_id, int depth) {
+    FFQPrefetch* prefetch = (FFQPrefetch*)malloc(sizeof(FFQPrefetch));
+    prefetch->handle = handle;
+    prefetch->consumer_id = consumer_id;
+    prefetch->depth = depth;
+    prefetch->oldest = 0;
+    prefetch->active = 0;
+    prefetch->requests = (FFQRequest*)malloc(depth * sizeof(FFQRequest));
+    prefetch->items = (WeatherRecord*)malloc(depth * sizeof(WeatherRecord));
+    return prefetch;
+}
+
+void ffq_prefetch_fill(FFQPrefetch* prefetch) {
+    // Free slots follow the active ones, so start order is slot order
+    while (prefetch->active < prefetch->depth) {
+        int slot = (prefetch->oldest + prefetch->active) % prefetch->depth;
+        ffq_idequeue(prefetch->handle, prefetch->consumer_id,
+                     &prefetch->items[slot], &prefetch->requests[slot]);
+        prefetch->active++;
+    }
+    for (int i = 0; i < prefetch->active; i++) {
+        ffq_test(&prefetch->requests[(prefetch->oldest + i) % prefetch->depth]);
+    }
+}
+
+bool ffq_prefetch_take(FFQPrefetch* prefetch, WeatherRecord* item) {
+    if (prefetch->active == 0) {
+        return false;
+    }
+
+    int slot = prefetch->oldest;
+    bool success = ffq_wait(&prefetch->requests[slot]);
+    if (success) {
+        *item = prefetch->items[slot];
+    }
+    prefetch->oldest = (slot + 1) % prefetch->depth;
+    prefetch->active--;
+    return success;
+}
+
+void ffq_prefetch_free(FFQPrefetch* prefetch) {
+    if (prefetch) {
+        free(prefetch->requests);
+        free(prefetch->items);
+        free(prefetch);
+    }
+}
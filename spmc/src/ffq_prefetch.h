@@ -0,0 +1,40 @@
+#ifndef FFQ_PREFETCH_H
+#define FFQ_PREFETCH_H
+
+#include <stdbool.h>
+#include "ffq.h"
+
+// A consumer's window of dequeues started ahead of use (see ffq_idequeue).
+// Up to depth items are claimed and fetched while the consumer processes
+// the current one, so the round trips to the queue overlap its work
+// instead of following it. Items are taken in the order their dequeues
+// were started. Every started dequeue holds a rank of the queue until it
+// is taken, so a consumer stopping on a sentinel must take the rest of
+// its window too (and producers must send enough sentinels to fill it).
+typedef struct
+{
+    FFQHandle *handle;
+    int consumer_id;
+    int depth;
+    int oldest;               // Slot of the oldest started dequeue
+    int active;               // Dequeues started and not taken yet
+    FFQRequest *requests;     // Ring of depth requests
+    WeatherRecord *items;     // Where each request stores its item
+} FFQPrefetch;
+
+// Create an empty window of depth slots (local)
+FFQPrefetch *ffq_prefetch_create(FFQHandle *handle, int consumer_id, int depth);
+
+// Start a dequeue in every free slot, then advance all of them as far as
+// they go without waiting. Call before processing an item.
+void ffq_prefetch_fill(FFQPrefetch *prefetch);
+
+// Take the item of the oldest started dequeue, waiting for it. Returns
+// false if the window is empty or the dequeue timed out; its slot is
+// free either way.
+bool ffq_prefetch_take(FFQPrefetch *prefetch, WeatherRecord *item);
+
+// Free a window. Every started dequeue must have been taken.
+void ffq_prefetch_free(FFQPrefetch *prefetch);
+
+#endif // FFQ_PREFETCH_H
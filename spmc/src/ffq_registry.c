@@ -0,0 +1,62 @@
+#include "ffq_registry.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+FFQRegistry* ffq_registry_create(MPI_Comm comm) {
+    FFQRegistry* registry = (FFQRegistry*)malloc(sizeof(FFQRegistry));
+    registry->comm = comm;
+    registry->count = 0;
+
+    // Memory is attached queue by queue, so the window starts empty.
+    // Its one epoch lasts until the registry is freed.
+    MPI_Win_create_dynamic(MPI_INFO_NULL, comm, &registry->win);
+    MPI_Win_lock_all(0, registry->win);
+    return registry;
+}
+
+FFQHandle* ffq_registry_add(FFQRegistry* registry, const char* name, int size,
+                            const FFQOptions* options) {
+    // Every rank sees the same names, so they all reject the same calls
+    if (ffq_registry_find(registry, name) != NULL) {
+        fprintf(stderr, "Warning: queue '%s' already exists\n", name);
+        return NULL;
+    }
+    if (registry->count == FFQ_REGISTRY_MAX_QUEUES) {
+        fprintf(stderr, "Warning: queue registry full, '%s' not created\n", name);
+        return NULL;
+    }
+
+    FFQOptions attached = *options;
+    attached.window = registry->win;
+    FFQHandle* handle = ffq_init(size, registry->comm, &attached);
+
+    FFQRegistryEntry* entry = &registry->queues[registry->count++];
+    strncpy(entry->name, name, FFQ_QUEUE_NAME_LEN - 1);
+    entry->name[FFQ_QUEUE_NAME_LEN - 1] = '\0';
+    entry->handle = handle;
+    return handle;
+}
+
+FFQHandle* ffq_registry_find(const FFQRegistry* registry, const char* name) {
+    for (int i = 0; i < registry->count; i++) {
+        if (strncmp(registry->queues[i].name, name, FFQ_QUEUE_NAME_LEN - 1) == 0) {
+            return registry->queues[i].handle;
+        }
+    }
+    return NULL;
+}
+
+void ffq_registry_free(FFQRegistry* registry) {
+    if (registry) {
+        // No rank may still access a queue once its memory is detached
+        MPI_Win_flush_all(registry->win);
+        MPI_Barrier(registry->comm);
+        for (int i = 0; i < registry->count; i++) {
+            ffq_cleanup(registry->queues[i].handle);
+        }
+        MPI_Win_unlock_all(registry->win);
+        MPI_Win_free(&registry->win);
+        free(registry);
+    }
+}
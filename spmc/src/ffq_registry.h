@@ -0,0 +1,50 @@
+#ifndef FFQ_REGISTRY_H
+#define FFQ_REGISTRY_H
+
+#include <mpi.h>
+#include "ffq.h"
+
+#define FFQ_REGISTRY_MAX_QUEUES 16
+#define FFQ_QUEUE_NAME_LEN 32
+
+typedef struct
+{
+    char name[FFQ_QUEUE_NAME_LEN];
+    FFQHandle *handle;
+} FFQRegistryEntry;
+
+// Named queues of one job (e.g. the stages of a pipeline) sharing a
+// single dynamic window. Each queue is attached to it on rank 0 with its
+// own size and options, so adding a queue costs an MPI_Win_attach instead
+// of a new window and its synchronization. One lock_all epoch, held by the
+// registry, covers every queue (pipeline_mode.c chains two queues this
+// way). Every queue carries WeatherRecord payloads and record classes are
+// told apart by the queue they travel on: the queue routes and stops on
+// record fields (the priority lane on the AQI, stealing and the modes on
+// the sentinel flag), so a per-queue payload type would need an untyped
+// interface in both backends rather than a datatype in FFQOptions.
+typedef struct
+{
+    MPI_Comm comm;
+    MPI_Win win; // Dynamic window every queue is attached to
+    int count;
+    FFQRegistryEntry queues[FFQ_REGISTRY_MAX_QUEUES];
+} FFQRegistry;
+
+// Create an empty registry over comm and open its epoch (collective)
+FFQRegistry *ffq_registry_create(MPI_Comm comm);
+
+// Create the queue name with the given size and options (options->window
+// is ignored) and attach it to the registry's window (collective, with
+// the same arguments on every rank). Returns NULL if the name is taken or
+// the registry is full.
+FFQHandle *ffq_registry_add(FFQRegistry *registry, const char *name, int size,
+                            const FFQOptions *options);
+
+// Return the queue called name, or NULL (local)
+FFQHandle *ffq_registry_find(const FFQRegistry *registry, const char *name);
+
+// Detach and free every queue, then the window and the registry (collective)
+void ffq_registry_free(FFQRegistry *registry);
+
+#endif // FFQ_REGISTRY_H
@@ -0,0 +1,85 @@
+#include "ffq_threads.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+FFQThreadQueue* ffq_threads_create(int size, const WaitPolicy* wait) {
+    FFQThreadQueue* queue = (FFQThreadQueue*)aligned_alloc(FFQ_CACHE_LINE, sizeof(FFQThreadQueue));
+    queue->cells = (FFQThreadCell*)aligned_alloc(FFQ_CACHE_LINE, size * sizeof(FFQThreadCell));
+    queue->payloads = (WeatherRecord*)calloc(size, sizeof(WeatherRecord));
+    queue->size = size;
+    queue->wait = *wait;
+    atomic_init(&queue->head, 0);
+    queue->tail = 0;
+    
+    for (int i = 0; i < size; i++) {
+        atomic_init(&queue->cells[i].state, FFQ_STATE(EMPTY_CELL, EMPTY_CELL));
+    }
+    return queue;
+}
+
+void ffq_threads_enqueue(FFQThreadQueue* queue, const WeatherRecord* item) {
+    Waiter waiter;
+    waiter_init(&waiter, &queue->wait);
+    
+    while (true) {
+        int rank = queue->tail++;
+        int idx = rank % queue->size;
+        _Atomic int64_t* state_word = &queue->cells[idx].state;
+        int64_t state = atomic_load_explicit(state_word, memory_order_acquire);
+        
+        if (FFQ_STATE_RANK(state) < 0) {
+            // The payload is written before the release publishes the rank
+            queue->payloads[idx] = *item;
+            atomic_fetch_xor_explicit(state_word, FFQ_RANK_FLIP(EMPTY_CELL, rank), 
+                                      memory_order_release);
+            printf("Producer enqueued item for city %u at cell %d (rank %d)\n", 
+                   item->city_id, idx, rank);
+            return;
+        }
+        
+        // Cell still in use: give its rank up as a gap, the consumer may
+        // clear the rank half meanwhile
+        atomic_fetch_xor_explicit(state_word, FFQ_GAP_FLIP(FFQ_STATE_GAP(state), rank), 
+                                  memory_order_release);
+        printf("Producer skipped cell %d (rank %d)\n", idx, rank);
+        waiter_pause(&waiter);
+    }
+}
+
+void ffq_threads_dequeue(FFQThreadQueue* queue, int consumer_id, WeatherRecord* item) {
+    int rank = atomic_fetch_add_explicit(&queue->head, 1, memory_order_relaxed);
+    int idx = rank % queue->size;
+    Waiter waiter;
+    waiter_init(&waiter, &queue->wait);
+    
+    while (true) {
+        _Atomic int64_t* state_word = &queue->cells[idx].state;
+        int64_t state = atomic_load_explicit(state_word, memory_order_acquire);
+        
+        if (FFQ_STATE_RANK(state) == rank) {
+            *item = queue->payloads[idx];
+            atomic_fetch_xor_explicit(state_word, FFQ_RANK_FLIP(rank, EMPTY_CELL), 
+                                      memory_order_release);
+            printf("Consumer %d dequeued item for (timestamp %lld, city %u, aqi %d, wind_speed %f, humidity %u) from cell %d (rank %d)\n",
+                   consumer_id, (long long)item->timestamp_us, item->city_id, item->aqi, 
+                   item->wind_speed, item->humidity, idx, rank);
+            return;
+        }
+        if (FFQ_STATE_GAP(state) >= rank) {
+            // The producer skipped this rank, claim another one
+            rank = atomic_fetch_add_explicit(&queue->head, 1, memory_order_relaxed);
+            idx = rank % queue->size;
+            printf("Consumer %d skipped to rank %d (cell %d)\n", consumer_id, rank, idx);
+            continue;
+        }
+        waiter_pause(&waiter);
+    }
+}
+
+void ffq_threads_free(FFQThreadQueue* queue) {
+    if (queue) {
+        free(queue->cells);
+        free(queue->payloads);
+        free(queue);
+    }
+}
@@ -0,0 +1,44 @@
+#ifndef FFQ_THREADS_H
+#define FFQ_THREADS_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include "ffq.h"
+#include "wait_policy.h"
+
+// State word of a cell of the in-process queue, packed as in ffq.h
+typedef struct
+{
+    _Alignas(FFQ_CACHE_LINE) _Atomic int64_t state;
+} FFQThreadCell;
+
+// The FFQ algorithm between threads of one process, without MPI: one
+// producer thread, any number of consumer threads. The producer writes a
+// free cell and publishes its rank with a release XOR of the state word,
+// or marks a busy cell's gap and moves on; consumers claim ranks with
+// fetch_add on head and recycle the cell with a release XOR once its
+// payload is copied. Cells and payloads are laid out as in the MPI queue,
+// so both measure the same algorithm, with and without the MPI layer.
+typedef struct
+{
+    FFQThreadCell *cells;
+    WeatherRecord *payloads;
+    int size;
+    WaitPolicy wait;                           // How retry loops wait
+    _Alignas(FFQ_CACHE_LINE) _Atomic int head; // Next rank to claim
+    _Alignas(FFQ_CACHE_LINE) int tail;         // Next rank to write (producer only)
+} FFQThreadQueue;
+
+// Create an empty queue of size cells
+FFQThreadQueue *ffq_threads_create(int size, const WaitPolicy *wait);
+
+// Enqueue item (producer thread), skipping busy cells until one is free
+void ffq_threads_enqueue(FFQThreadQueue *queue, const WeatherRecord *item);
+
+// Dequeue an item (consumer threads), waiting for the producer
+void ffq_threads_dequeue(FFQThreadQueue *queue, int consumer_id, WeatherRecord *item);
+
+// Free a queue no thread uses anymore
+void ffq_threads_free(FFQThreadQueue *queue);
+
+#endif // FFQ_THREADS_H
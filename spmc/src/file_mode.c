@@ -1,5 +1,7 @@
 #include "file_mode.h"
 #include "common.h"
+#include "ffq_prefetch.h"
+#include "spill_buffer.h"
 #include <stdio.h>
 #include <string.h>
 #include <sys/stat.h>
@@ -54,13 +56,109 @@ bool parse_csv_line(char* line, WeatherData* data) {
     return true;
 }
 
-void run_file_producer(FFQueue* queue, const char* csv_file, int delay_ms, MPI_Win win) {
-    printf("File producer started with file: %s\n", csv_file);
+void fill_file_dict(WeatherDict* dict, const char* csv_file) {
+    FILE* file = fopen(csv_file, "rb");
+    if (file == NULL) {
+        return;
+    }
+    
+    char line[MAX_LINE_LENGTH];
+    while (fgets(line, MAX_LINE_LENGTH, file)) {
+        WeatherData data;
+        memset(&data, 0, sizeof(WeatherData));
+        if (parse_csv_line(line, &data)) {
+            weather_dict_intern(dict, data.city);
+            weather_dict_intern(dict, data.weather_icon);
+        }
+    }
+    fclose(file);
+}
+
+// Enqueue the records read so far and reset the batch. With a spill
+// buffer, records the queue has no credit for are spilled instead, and
+// once anything is spilled new records queue up behind it.
+static void flush_batch(FFQHandle* handle, SpillBuffer* spill, WeatherRecord* batch, 
+                        WeatherData* parsed, int* batch_count) {
+    if (*batch_count == 0) {
+        return;
+    }
+    
+    int direct = *batch_count;
+    if (spill) {
+        spill_buffer_drain(spill, handle, ENQUEUE_BATCH_SIZE);
+        int credit = spill_buffer_count(spill) > 0 ? 0 : ffq_credit(handle);
+        direct = credit < *batch_count ? credit : *batch_count;
+        
+        if (direct < *batch_count && spill_buffer_count(spill) == 0) {
+            printf("Queue full, spilling records to %s\n", spill->path);
+        }
+        if (direct < *batch_count && 
+            !spill_buffer_append(spill, batch + direct, *batch_count - direct)) {
+            // The disk is full: let the queue hold back ingest after all,
+            // keeping the spilled records ahead of the new ones
+            printf("Cannot grow spill file %s, waiting for the queue\n", spill->path);
+            while (spill_buffer_count(spill) > 0) {
+                spill_buffer_drain(spill, handle, ENQUEUE_BATCH_SIZE);
+                do_work(1);
+            }
+            direct = *batch_count;
+        }
+    }
+    
+    if (direct == 1) {
+        ffq_enqueue(handle, batch[0]);
+    } else if (direct > 1) {
+        ffq_enqueue_batch(handle, batch, direct);
+    }
+    
+    for (int i = 0; i < *batch_count; i++) {
+        print_weather_data(&parsed[i]);
+    }
+    *batch_count = 0;
+}
+
+// Backpressure without a spill file: while the queue has no free cell,
+// stop reading the file so new records wait there rather than in the producer
+static void hold_ingest(FFQHandle* handle, int producer_id) {
+    if (ffq_credit(handle) > 0) {
+        return;
+    }
+    
+    double start = MPI_Wtime();
+    printf("Producer %d: queue full, ingest paused\n", producer_id);
+    while (ffq_credit(handle) == 0) {
+        do_work(1);
+    }
+    printf("Producer %d: ingest resumed after %.3f s\n", producer_id, MPI_Wtime() - start);
+}
+
+void run_file_producer(FFQHandle* handle, WeatherDict* dict, MPI_Comm producers,
+                       const char* csv_file, int delay_ms, const char* spill_file) {
+    int producer_id, num_producers;
+    MPI_Comm_rank(producers, &producer_id);
+    MPI_Comm_size(producers, &num_producers);
+    printf("File producer %d started with file: %s\n", producer_id, csv_file);
+    
+    // Every producer spills to a file of its own
+    SpillBuffer* spill = NULL;
+    if (spill_file[0] != '\0') {
+        char path[256];
+        if (num_producers > 1) {
+            snprintf(path, sizeof(path), "%s.%d", spill_file, producer_id);
+        } else {
+            snprintf(path, sizeof(path), "%s", spill_file);
+        }
+        spill = spill_buffer_create(path);
+    }
     
     FILE* file = NULL;
     char line[MAX_LINE_LENGTH];
+    WeatherRecord batch[ENQUEUE_BATCH_SIZE];
+    WeatherData parsed[ENQUEUE_BATCH_SIZE]; // Kept for printing
+    int batch_count = 0;
     struct stat file_stat, last_stat;
     long file_pos = 0;
+    long record_index = 0; // Records of the file seen so far, by every producer
     
     // Initialize stats
     memset(&file_stat, 0, sizeof(file_stat));
@@ -86,6 +184,7 @@ void run_file_producer(FFQueue* queue, const char* csv_file, int delay_ms, MPI_W
                 continue;
             }
             file_pos = 0;
+            record_index = 0;
             printf("Opened file %s\n", csv_file);
         }
         
@@ -96,22 +195,44 @@ void run_file_producer(FFQueue* queue, const char* csv_file, int delay_ms, MPI_W
             // Seek to the last position we read
             fseek(file, file_pos, SEEK_SET);
             
-            // Read new data
-            while (fgets(line, MAX_LINE_LENGTH, file)) {
-                WeatherData data;
-                memset(&data, 0, sizeof(WeatherData));
+            // Read new data, as far as the queue takes it
+            while (true) {
+                if (!spill) {
+                    hold_ingest(handle, producer_id);
+                }
+                if (!fgets(line, MAX_LINE_LENGTH, file)) {
+                    break;
+                }
+                WeatherData* data = &parsed[batch_count];
+                memset(data, 0, sizeof(WeatherData));
+                file_pos = ftell(file);
                 
-                if (parse_csv_line(line, &data)) {
-                    ffq_enqueue(queue, data, win);
-                    print_weather_data(&data);
+                if (!parse_csv_line(line, data)) {
+                    continue;
                 }
+                if (record_index++ % num_producers != producer_id) {
+                    continue; // Another producer's record
+                }
+                weather_record_pack(dict, data, &batch[batch_count++]);
                 
-                file_pos = ftell(file);
+                // With a delay every record is paced individually,
+                // otherwise records are shipped in full batches
+                if (delay_ms > 0 || batch_count == ENQUEUE_BATCH_SIZE) {
+                    flush_batch(handle, spill, batch, parsed, &batch_count);
+                }
                 do_work(delay_ms);
             }
             
+            // Ship whatever is left before waiting for more data
+            flush_batch(handle, spill, batch, parsed, &batch_count);
+            ffq_publish_tail(handle);
+            
             // Update last known stats
             last_stat = file_stat;
+        } else if (spill && spill_buffer_count(spill) > 0) {
+            // No changes, feed spilled records back as cells free up
+            spill_buffer_drain(spill, handle, ENQUEUE_BATCH_SIZE);
+            do_work(1);
         } else {
             // No changes, wait a bit
             do_work(500);
@@ -122,21 +243,48 @@ void run_file_producer(FFQueue* queue, const char* csv_file, int delay_ms, MPI_W
     if (file != NULL) {
         fclose(file);
     }
+    spill_buffer_free(spill);
 }
 
-void run_file_consumer(FFQueue* queue, int consumer_id, int delay_ms, MPI_Win win) {
+void run_file_consumer(FFQHandle* handle, WeatherDict* dict, int consumer_id, int delay_ms,
+                       int prefetch) {
     printf("File consumer %d started\n", consumer_id);
     
+    // Claim several ranks at once for high-rate replays; with a processing
+    // delay a large claim would only hold items other consumers could take
+    WeatherRecord items[DEQUEUE_BATCH_SIZE];
+    int batch_limit = delay_ms > 0 ? 1 : DEQUEUE_BATCH_SIZE;
+    Waiter waiter;
+    waiter_init(&waiter, &handle->wait);
+    
+    // With prefetch, records are instead taken one by one from a window
+    // of dequeues refilled before each record is processed
+    FFQPrefetch* window = NULL;
+    if (prefetch > 0) {
+        window = ffq_prefetch_create(handle, consumer_id, prefetch);
+        ffq_prefetch_fill(window);
+    }
+    
     while (true) {
-        WeatherData item;
-        if (ffq_dequeue(queue, consumer_id, &item, win)) {
-            print_weather_data(&item);
-            do_work(delay_ms);
+        int count = window ? (ffq_prefetch_take(window, &items[0]) ? 1 : 0)
+                           : ffq_dequeue_batch(handle, consumer_id, items, batch_limit);
+        if (window) {
+            ffq_prefetch_fill(window);
+        }
+        if (count > 0) {
+            waiter_reset(&waiter);
+            for (int i = 0; i < count; i++) {
+                WeatherData data;
+                weather_record_unpack(dict, &items[i], &data);
+                print_weather_data(&data);
+                do_work(delay_ms);
+            }
         } else {
-            do_work(100); // Small wait if nothing to dequeue
+            waiter_pause(&waiter); // Nothing to dequeue, wait before retrying
         }
     }
     
     // This part will never be reached in this implementation
+    ffq_prefetch_free(window);
     printf("File consumer %d finished\n", consumer_id);
 } 
\ No newline at end of file
@@ -5,14 +5,26 @@
 #include <mpi.h>
 #include "ffq.h"
 #include "weather_data.h"
+#include "weather_dict.h"
 
 // Parse a CSV line into a WeatherData struct
 bool parse_csv_line(char *line, WeatherData *data);
 
-// Run producer in file mode - continuously reads from a CSV file
-void run_file_producer(FFQueue *queue, const char *csv_file, int delay_ms, MPI_Win win);
+// Add the cities and icons found in a CSV file to the dictionary
+void fill_file_dict(WeatherDict *dict, const char *csv_file);
 
-// Run consumer in file mode
-void run_file_consumer(FFQueue *queue, int consumer_id, int delay_ms, MPI_Win win);
+// Run producer in file mode - continuously reads from a CSV file.
+// With several producers (the ranks of producers) each one follows the
+// whole file and enqueues every n-th record. While the queue is full
+// (as far as it tracks credit, see ffq_credit), records go to spill_file (suffixed with the producer id when there
+// are several) and reading carries on; with an empty spill_file reading
+// pauses until the queue has room.
+void run_file_producer(FFQHandle *handle, WeatherDict *dict, MPI_Comm producers,
+                       const char *csv_file, int delay_ms, const char *spill_file);
+
+// Run consumer in file mode. With prefetch > 0 up to prefetch records are
+// dequeued ahead while one is processed (see ffq_prefetch.h).
+void run_file_consumer(FFQHandle *handle, WeatherDict *dict, int consumer_id, int delay_ms,
+                       int prefetch);
 
 #endif // FILE_MODE_H
\ No newline at end of file
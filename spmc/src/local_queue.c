@@ -0,0 +1,74 @@
+#include "local_queue.h"
+#include <stddef.h>
+#include <stdlib.h>
+
+LocalQueue* local_queue_create(int capacity) {
+    size_t size = 1;
+    while (size < (size_t)capacity) {
+        size *= 2;
+    }
+    
+    LocalQueue* queue = (LocalQueue*)aligned_alloc(FFQ_CACHE_LINE, sizeof(LocalQueue));
+    queue->slots = (LocalSlot*)aligned_alloc(FFQ_CACHE_LINE, size * sizeof(LocalSlot));
+    queue->mask = size - 1;
+    for (size_t i = 0; i < size; i++) {
+        atomic_init(&queue->slots[i].sequence, i);
+    }
+    atomic_init(&queue->head, 0);
+    queue->tail = 0;
+    atomic_init(&queue->closed, false);
+    return queue;
+}
+
+bool local_queue_push(LocalQueue* queue, const WeatherRecord* item) {
+    LocalSlot* slot = &queue->slots[queue->tail & queue->mask];
+    
+    // The slot is free for this lap once its last item was popped
+    if (atomic_load_explicit(&slot->sequence, memory_order_acquire) != queue->tail) {
+        return false;
+    }
+    slot->item = *item;
+    atomic_store_explicit(&slot->sequence, queue->tail + 1, memory_order_release);
+    queue->tail++;
+    return true;
+}
+
+bool local_queue_pop(LocalQueue* queue, WeatherRecord* item) {
+    size_t head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    
+    while (true) {
+        LocalSlot* slot = &queue->slots[head & queue->mask];
+        size_t sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+        
+        if (sequence == head + 1) {
+            // Published: claim it, or learn the new head on failure
+            if (atomic_compare_exchange_weak_explicit(&queue->head, &head, head + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                *item = slot->item;
+                // Hand the slot to the pusher's next lap
+                atomic_store_explicit(&slot->sequence, head + queue->mask + 1, memory_order_release);
+                return true;
+            }
+        } else if ((ptrdiff_t)(sequence - head) <= 0) {
+            return false; // Not pushed yet, or its last item still being copied
+        } else {
+            // Another popper took it meanwhile
+            head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+        }
+    }
+}
+
+void local_queue_close(LocalQueue* queue) {
+    atomic_store_explicit(&queue->closed, true, memory_order_release);
+}
+
+bool local_queue_closed(LocalQueue* queue) {
+    return atomic_load_explicit(&queue->closed, memory_order_acquire);
+}
+
+void local_queue_free(LocalQueue* queue) {
+    if (queue) {
+        free(queue->slots);
+        free(queue);
+    }
+}
@@ -0,0 +1,49 @@
+#ifndef LOCAL_QUEUE_H
+#define LOCAL_QUEUE_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "ffq.h"
+
+// Rank-local queue handing records from a consumer rank's communication
+// thread to its worker threads. A bounded ring in ordinary memory: every
+// slot carries a sequence number telling which lap's item it holds, so the
+// pusher and the poppers only meet on the slot they touch and on the head,
+// which poppers claim by compare-and-swap. No locks, no MPI calls.
+// One thread pushes, any number of threads pop.
+typedef struct
+{
+    _Alignas(FFQ_CACHE_LINE) _Atomic size_t sequence;
+    WeatherRecord item;
+} LocalSlot;
+
+typedef struct
+{
+    LocalSlot *slots;
+    size_t mask;                                  // Capacity - 1, a power of two
+    _Alignas(FFQ_CACHE_LINE) _Atomic size_t head; // Next slot to pop
+    _Alignas(FFQ_CACHE_LINE) size_t tail;         // Next slot to push (pusher only)
+    _Atomic bool closed;                          // Nothing more will be pushed
+} LocalQueue;
+
+// Create an empty queue of at least capacity slots
+LocalQueue *local_queue_create(int capacity);
+
+// Append item (pusher). Returns false if the queue is full.
+bool local_queue_push(LocalQueue *queue, const WeatherRecord *item);
+
+// Take the oldest item (any thread). Returns false if the queue is empty.
+bool local_queue_pop(LocalQueue *queue, WeatherRecord *item);
+
+// Mark the queue as finished after the last push (pusher)
+void local_queue_close(LocalQueue *queue);
+
+// Whether the queue was closed. Read it before a pop: a pop that then
+// finds the queue empty means it is drained for good.
+bool local_queue_closed(LocalQueue *queue);
+
+// Free a queue no thread uses anymore
+void local_queue_free(LocalQueue *queue);
+
+#endif // LOCAL_QUEUE_H
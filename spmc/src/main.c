@@ -6,92 +6,221 @@
 #include "common.h"
 #include "ffq.h"
 #include "weather_data.h"
+#include "weather_dict.h"
 #include "test_mode.h"
 #include "file_mode.h"
 #include "benchmark_mode.h"
+#include "pipeline_mode.h"
 
 int main(int argc, char** argv) {
-    int rank, size;
-    MPI_Win win;
+    int rank, size, thread_level;
     ProgramConfig config;
     
-    MPI_Init(&argc, &argv);
+    // Worker threads of hybrid consumers never call MPI, so only the main
+    // thread needs to
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &thread_level);
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
     MPI_Comm_size(MPI_COMM_WORLD, &size);
     
     // Parse command line arguments
     parse_args(argc, argv, &config);
+    if (config.threads > 0 && thread_level < MPI_THREAD_FUNNELED) {
+        config.threads = 0;
+        if (rank == 0) {
+            printf("MPI provides no thread support, consumers run without worker threads\n");
+        }
+    }
+    
+    // Ranks below config.producers produce, every other rank consumes
+    // (the threads benchmark runs inside rank 0 and needs no other rank)
+    if (config.mode != THREADS_MODE && config.producers >= size) {
+        if (rank == 0) {
+            printf("Need more processes than producers (%d producers, %d processes)\n",
+                   config.producers, size);
+        }
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    if (config.mode == PIPELINE_MODE && size < 3) {
+        if (rank == 0) {
+            printf("Pipeline mode needs at least 3 processes (source, filter, sink)\n");
+        }
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    bool is_producer = rank < config.producers;
+    
+    // A prefetching consumer holds ranks ahead of the one it processes; all
+    // of them must fit in the ring at once, or the sentinels filling them
+    // at the end could find no free cell
+    int num_consumers = size - config.producers;
+    if (config.prefetch * num_consumers > config.queue_size) {
+        config.prefetch = config.queue_size / num_consumers;
+        if (rank == 0) {
+            printf("Prefetch reduced to %d so every consumer's claims fit in the queue\n",
+                   config.prefetch);
+        }
+    }
+    MPI_Comm role_comm;
+    MPI_Comm_split(MPI_COMM_WORLD, is_producer ? 0 : 1, rank, &role_comm);
+    
+    int thread_consumers = config.threads > 0 ? config.threads : DEFAULT_THREAD_CONSUMERS;
+    char wait_name[64];
+    wait_policy_format(&config.wait, wait_name, sizeof(wait_name));
     
     // Print configuration
     if (rank == 0) {
         printf("Configuration:\n");
         printf("  Mode: %s\n", 
                config.mode == TEST_MODE ? "test" : 
-               (config.mode == BENCHMARK_MODE ? "benchmark" : "file"));
+               (config.mode == BENCHMARK_MODE ? "benchmark" : 
+               (config.mode == FILE_MODE ? "file" : 
+               (config.mode == THREADS_MODE ? "threads" : "pipeline"))));
         printf("  Queue size: %d\n", config.queue_size);
+        if (config.max_queue_size > 0) {
+            printf("  Max queue size: %d\n", config.max_queue_size);
+        }
+        printf("  Layout: %s%s\n", layout_name(config.layout), config.steal ? " (work stealing)" : "");
+        printf("  Wait policy: %s\n", wait_name);
+        printf("  Producers: %d\n", config.producers);
+        if (config.priority_aqi >= 0) {
+            printf("  Priority lane: AQI >= %d (%d cells)\n", config.priority_aqi, config.priority_size);
+        }
+        if (config.prefetch > 0) {
+            printf("  Prefetch: %d items per consumer\n", config.prefetch);
+        }
+        if (config.mode == BENCHMARK_MODE && config.threads > 0) {
+            printf("  Worker threads: %d per consumer\n", config.threads);
+        } else if (config.mode == THREADS_MODE) {
+            printf("  Consumer threads: %d\n", thread_consumers);
+        }
         printf("  Number of items: %d\n", config.num_items);
         printf("  Producer delay: %d ms\n", config.producer_delay_ms);
         printf("  Consumer delay: %d ms\n", config.consumer_delay_ms);
         if (config.mode == FILE_MODE || config.mode == BENCHMARK_MODE) {
             printf("  CSV file: %s\n", config.csv_file);
         }
+        if (config.mode == FILE_MODE && config.spill_file[0] != '\0') {
+            printf("  Spill file: %s\n", config.spill_file);
+        }
         printf("  Number of processes: %d\n", size);
     }
     
-    // Initialize the queue
-    FFQueue* queue = ffq_init(config.queue_size, &win, MPI_COMM_WORLD);
+    // Initialize the queue (the threads benchmark and the pipeline bring
+    // their own)
+    FFQHandle* handle = NULL;
+    FFQOptions options = {config.layout, config.wait, config.producers, MPI_WIN_NULL,
+                          config.priority_aqi >= 0 ? config.priority_size : 0, config.priority_aqi,
+                          config.max_queue_size, config.steal};
+    if (config.mode != THREADS_MODE && config.mode != PIPELINE_MODE) {
+        handle = ffq_init(config.queue_size, MPI_COMM_WORLD, &options);
+    }
+    
+    // Records carry string ids only: rank 0 collects the strings of the
+    // input up front, they are replicated to every rank once and strings
+    // first seen later are pulled by the other ranks on demand
+    WeatherDict* dict = (WeatherDict*)malloc(sizeof(WeatherDict));
+    weather_dict_init(dict);
+    if (rank == 0) {
+        if (config.mode == TEST_MODE || config.mode == PIPELINE_MODE) {
+            fill_test_dict(dict, config.num_items);
+        } else if (config.mode == FILE_MODE) {
+            fill_file_dict(dict, config.csv_file);
+        } else {
+            fill_benchmark_dict(dict);
+        }
+    }
+    if (config.mode != THREADS_MODE) {
+        weather_dict_share(dict, 0, MPI_COMM_WORLD);
+    }
+    
+    // Both benchmarks also write their results to a file (only rank 0)
+    FILE* result_file = NULL;
+    if (rank == 0 && (config.mode == BENCHMARK_MODE || config.mode == THREADS_MODE)) {
+        ensure_benchmark_dir();
+        
+        // Open benchmark result file (overwrite existing)
+        result_file = fopen(BENCHMARK_RESULT_FILE, "w");
+        if (result_file) {
+            fprintf(result_file, "FFQ Benchmark Results\n");
+            fprintf(result_file, "====================\n\n");
+            fprintf(result_file, "Configuration:\n");
+            if (config.mode == THREADS_MODE) {
+                fprintf(result_file, "  Mode: threads\n");
+            }
+            fprintf(result_file, "  Queue size: %d\n", config.queue_size);
+            if (config.max_queue_size > 0) {
+                fprintf(result_file, "  Max queue size: %d\n", config.max_queue_size);
+            }
+            fprintf(result_file, "  Layout: %s%s\n", layout_name(config.layout),
+                    config.steal ? " (work stealing)" : "");
+            fprintf(result_file, "  Wait policy: %s\n", wait_name);
+            fprintf(result_file, "  Producers: %d\n", config.producers);
+            if (config.priority_aqi >= 0) {
+                fprintf(result_file, "  Priority lane: AQI >= %d (%d cells)\n",
+                        config.priority_aqi, config.priority_size);
+            }
+            if (config.prefetch > 0) {
+                fprintf(result_file, "  Prefetch: %d items per consumer\n", config.prefetch);
+            }
+            if (config.mode == THREADS_MODE) {
+                fprintf(result_file, "  Consumer threads: %d\n", thread_consumers);
+            } else if (config.threads > 0) {
+                fprintf(result_file, "  Worker threads: %d per consumer\n", config.threads);
+            }
+            fprintf(result_file, "  Producer delay: %d ms\n", config.producer_delay_ms);
+            fprintf(result_file, "  Consumer delay: %d ms\n", config.consumer_delay_ms);
+            fprintf(result_file, "  CSV file: %s\n", config.csv_file);
+            fprintf(result_file, "  Number of processes: %d\n", size);
+            fprintf(result_file, "  Number of consumers: %d\n\n",
+                    config.mode == THREADS_MODE ? thread_consumers : num_consumers);
+        } else {
+            printf("Warning: Could not open benchmark result file for writing.\n");
+        }
+    }
     
     // Run in selected mode
     if (config.mode == TEST_MODE) {
-        if (rank == 0) {
-            run_producer(queue, config.num_items, config.producer_delay_ms, win);
+        if (is_producer) {
+            run_producer(handle, dict, role_comm, config.num_items, config.producer_delay_ms);
         } else {
-            run_consumer(queue, rank, config.num_items, config.consumer_delay_ms, win);
+            run_consumer(handle, dict, rank, config.num_items, config.consumer_delay_ms);
         }
-    } else if (config.mode == FILE_MODE) {
+    } else if (config.mode == THREADS_MODE) {
         if (rank == 0) {
-            run_file_producer(queue, config.csv_file, config.producer_delay_ms, win);
+            if (size > 1) {
+                printf("Threads mode runs on rank 0, the other ranks stay idle\n");
+            }
+            run_threads_benchmark(dict, thread_consumers, config.queue_size, config.producer_delay_ms, 
+                                  config.consumer_delay_ms, &config.wait, result_file);
+            if (result_file) {
+                fclose(result_file);
+                printf("Benchmark results written to %s\n", BENCHMARK_RESULT_FILE);
+            }
+        }
+    } else if (config.mode == PIPELINE_MODE) {
+        run_pipeline(dict, MPI_COMM_WORLD, config.queue_size, config.num_items, &config.wait,
+                     config.producer_delay_ms, config.consumer_delay_ms);
+    } else if (config.mode == FILE_MODE) {
+        if (is_producer) {
+            run_file_producer(handle, dict, role_comm, config.csv_file, config.producer_delay_ms,
+                              config.spill_file);
         } else {
-            run_file_consumer(queue, rank, config.consumer_delay_ms, win);
+            run_file_consumer(handle, dict, rank, config.consumer_delay_ms, config.prefetch);
         }
     } else { // BENCHMARK_MODE
         BenchmarkStats stats = {0};
-        FILE* result_file = NULL;
-        
-        // Create benchmark result directory if needed (only by rank 0)
-        if (rank == 0) {
-            ensure_benchmark_dir();
-            
-            // Open benchmark result file (overwrite existing)
-            result_file = fopen(BENCHMARK_RESULT_FILE, "w");
-            if (result_file) {
-                fprintf(result_file, "FFQ Benchmark Results\n");
-                fprintf(result_file, "====================\n\n");
-                fprintf(result_file, "Configuration:\n");
-                fprintf(result_file, "  Queue size: %d\n", config.queue_size);
-                fprintf(result_file, "  Producer delay: %d ms\n", config.producer_delay_ms);
-                fprintf(result_file, "  Consumer delay: %d ms\n", config.consumer_delay_ms);
-                fprintf(result_file, "  CSV file: %s\n", config.csv_file);
-                fprintf(result_file, "  Number of processes: %d\n", size);
-                fprintf(result_file, "  Number of consumers: %d\n\n", size - 1);
-            } else {
-                printf("Warning: Could not open benchmark result file for writing.\n");
-            }
-        }
         
         // Just a small synchronization before starting
         MPI_Barrier(MPI_COMM_WORLD);
         
-        // Calculate number of consumers (total processes minus producer)
-        int num_consumers = size - 1;
-        
         // Run benchmark with producer and consumers working concurrently
-        if (rank == 0) {
+        BenchmarkQueue queue = benchmark_queue_mpi(handle);
+        if (is_producer) {
             // Producer process
-            run_benchmark_producer(queue, config.csv_file, config.producer_delay_ms, win, &stats, num_consumers, result_file);
+            run_benchmark_producer(&queue, dict, role_comm, config.csv_file, config.producer_delay_ms, &stats, num_consumers, config.prefetch, result_file);
         } else {
             // Consumer process
-            run_benchmark_consumer(queue, rank, config.consumer_delay_ms, win, &stats, NULL);
+            run_benchmark_consumer(&queue, rank, config.consumer_delay_ms, config.prefetch,
+                                   config.threads, &stats, NULL);
         }
         
         // Wait for all processes to finish
@@ -107,12 +236,23 @@ int main(int argc, char** argv) {
                       0, MPI_COMM_WORLD);
             
             // Calculate overall statistics
+            int total_produced = 0;
             int total_processed = 0;
             double max_end_time = all_stats[0].end_time;
             double min_start_time = all_stats[0].start_time;
+            double producer_time = 0;
+            
+            for (int i = 0; i < config.producers; i++) {
+                total_produced += all_stats[i].items_processed;
+                if (all_stats[i].end_time - all_stats[i].start_time > producer_time) {
+                    producer_time = all_stats[i].end_time - all_stats[i].start_time;
+                }
+            }
             
             for (int i = 1; i < size; i++) {
-                total_processed += all_stats[i].items_processed;
+                if (i >= config.producers) {
+                    total_processed += all_stats[i].items_processed;
+                }
                 if (all_stats[i].end_time > max_end_time) {
                     max_end_time = all_stats[i].end_time;
                 }
@@ -127,14 +267,14 @@ int main(int argc, char** argv) {
             // Print overall results
             printf("\nBenchmark Results:\n");
             printf("-----------------------------------\n");
-            printf("Total items produced: %d\n", all_stats[0].items_processed);
+            printf("Total items produced: %d\n", total_produced);
             printf("Total items consumed: %d\n", total_processed);
             printf("Total benchmark time: %.3f seconds\n", total_duration);
-            printf("Producer time: %.3f seconds\n", all_stats[0].end_time - all_stats[0].start_time);
+            printf("Producer time: %.3f seconds\n", producer_time);
             printf("Consumer time (max): %.3f seconds\n", max_end_time - min_start_time);
             
             // Print per-consumer stats
-            for (int i = 1; i < size; i++) {
+            for (int i = config.producers; i < size; i++) {
                 printf("Consumer %d: %d items, %.2f items/sec, time: %.3f sec\n", 
                        i, all_stats[i].items_processed, all_stats[i].throughput,
                        all_stats[i].end_time - all_stats[i].start_time);
@@ -142,26 +282,26 @@ int main(int argc, char** argv) {
             
             // Calculate and print overall throughput
             double overall_throughput = total_duration > 0 ? 
-                all_stats[0].items_processed / total_duration : 0;
+                total_produced / total_duration : 0;
                 
             printf("\nOverall throughput: %.2f items/second\n", overall_throughput);
             printf("Consumer efficiency: %.1f%%\n", 
-                   all_stats[0].items_processed > 0 ? 
-                   (total_processed * 100.0 / all_stats[0].items_processed) : 0);
+                   total_produced > 0 ? 
+                   (total_processed * 100.0 / total_produced) : 0);
             printf("-----------------------------------\n");
             
             // Write the same information to the result file
             if (result_file) {
                 fprintf(result_file, "\nBenchmark Results:\n");
                 fprintf(result_file, "-----------------------------------\n");
-                fprintf(result_file, "Total items produced: %d\n", all_stats[0].items_processed);
+                fprintf(result_file, "Total items produced: %d\n", total_produced);
                 fprintf(result_file, "Total items consumed: %d\n", total_processed);
                 fprintf(result_file, "Total benchmark time: %.3f seconds\n", total_duration);
-                fprintf(result_file, "Producer time: %.3f seconds\n", all_stats[0].end_time - all_stats[0].start_time);
+                fprintf(result_file, "Producer time: %.3f seconds\n", producer_time);
                 fprintf(result_file, "Consumer time (max): %.3f seconds\n", max_end_time - min_start_time);
                 
                 // Print per-consumer stats
-                for (int i = 1; i < size; i++) {
+                for (int i = config.producers; i < size; i++) {
                     fprintf(result_file, "Consumer %d: %d items, %.2f items/sec, time: %.3f sec\n", 
                            i, all_stats[i].items_processed, all_stats[i].throughput,
                            all_stats[i].end_time - all_stats[i].start_time);
@@ -169,8 +309,8 @@ int main(int argc, char** argv) {
                 
                 fprintf(result_file, "\nOverall throughput: %.2f items/second\n", overall_throughput);
                 fprintf(result_file, "Consumer efficiency: %.1f%%\n", 
-                       all_stats[0].items_processed > 0 ? 
-                       (total_processed * 100.0 / all_stats[0].items_processed) : 0);
+                       total_produced > 0 ? 
+                       (total_processed * 100.0 / total_produced) : 0);
                 fprintf(result_file, "-----------------------------------\n");
                 
                 // Close the result file
@@ -197,7 +337,12 @@ int main(int argc, char** argv) {
     }
     
     // Cleanup
-    MPI_Win_free(&win);
+    MPI_Comm_free(&role_comm);
+    if (handle) {
+        ffq_cleanup(handle);
+    }
+    weather_dict_unshare(dict);
+    free(dict);
     MPI_Finalize();
     
     return 0;
@@ -0,0 +1,93 @@
+#include "pipeline_mode.h"
+#include <stdio.h>
+#include "ffq_registry.h"
+#include "test_mode.h"
+#include "benchmark_mode.h"
+
+// Source stage: the test records, then one sentinel per filter
+static void run_source(FFQHandle* raw, WeatherDict* dict, int num_items, int filters, int delay_ms) {
+    int alerts = 0;
+    for (int i = 0; i < num_items; i++) {
+        WeatherData data = generate_test_data(i + 1);
+        WeatherRecord item;
+        weather_record_pack(dict, &data, &item);
+        ffq_enqueue(raw, item);
+        alerts += item.aqi >= PIPELINE_ALERT_AQI ? 1 : 0;
+        do_work(delay_ms);
+    }
+    for (int i = 0; i < filters; i++) {
+        ffq_enqueue(raw, create_sentinel_item());
+    }
+    printf("Pipeline source: %d records, %d with AQI >= %d\n", num_items, alerts, PIPELINE_ALERT_AQI);
+}
+
+// Filter stage: forward alerts until the source's sentinel, then pass one
+// sentinel on to the sink
+static void run_filter(FFQHandle* raw, FFQHandle* alerts, int rank, int delay_ms) {
+    int seen = 0, forwarded = 0;
+    WeatherRecord item;
+    while (true) {
+        if (!ffq_dequeue(raw, rank, &item)) {
+            continue; // Timed out, the claimed rank is resumed
+        }
+        if (is_sentinel_item(&item)) {
+            break;
+        }
+        seen++;
+        if (item.aqi >= PIPELINE_ALERT_AQI) {
+            ffq_enqueue(alerts, item);
+            forwarded++;
+        }
+        do_work(delay_ms);
+    }
+    ffq_enqueue(alerts, create_sentinel_item());
+    printf("Pipeline filter %d: forwarded %d of %d records\n", rank, forwarded, seen);
+}
+
+// Sink stage: print alerts until every filter has finished
+static void run_sink(FFQHandle* alerts, WeatherDict* dict, int rank, int filters, int delay_ms) {
+    int received = 0, finished = 0;
+    WeatherRecord item;
+    while (finished < filters) {
+        if (!ffq_dequeue(alerts, rank, &item)) {
+            continue;
+        }
+        if (is_sentinel_item(&item)) {
+            finished++;
+            continue;
+        }
+        WeatherData data;
+        weather_record_unpack(dict, &item, &data);
+        print_weather_data(&data);
+        received++;
+        do_work(delay_ms);
+    }
+    printf("Pipeline sink: %d alerts received\n", received);
+}
+
+void run_pipeline(WeatherDict* dict, MPI_Comm comm, int queue_size, int num_items,
+                  const WaitPolicy* wait, int producer_delay_ms, int consumer_delay_ms) {
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+    int filters = size - 2;
+    
+    // The source alone enqueues on "raw", every filter on "alerts"
+    FFQRegistry* registry = ffq_registry_create(comm);
+    FFQOptions raw_options = {FFQ_LAYOUT_CENTRAL, *wait, 1, MPI_WIN_NULL, 0, 0, 0, false};
+    FFQOptions alert_options = {FFQ_LAYOUT_CENTRAL, *wait, filters, MPI_WIN_NULL, 0, 0, 0, false};
+    ffq_registry_add(registry, "raw", queue_size, &raw_options);
+    ffq_registry_add(registry, "alerts", queue_size, &alert_options);
+    FFQHandle* raw = ffq_registry_find(registry, "raw");
+    FFQHandle* alerts = ffq_registry_find(registry, "alerts");
+    
+    if (rank == 0) {
+        run_source(raw, dict, num_items, filters, producer_delay_ms);
+    } else if (rank < size - 1) {
+        run_filter(raw, alerts, rank, consumer_delay_ms);
+    } else {
+        run_sink(alerts, dict, rank, filters, consumer_delay_ms);
+    }
+    
+    ffq_registry_free(registry);
+}
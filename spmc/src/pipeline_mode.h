@@ -0,0 +1,20 @@
+#ifndef PIPELINE_MODE_H
+#define PIPELINE_MODE_H
+
+#include <mpi.h>
+#include "ffq.h"
+#include "weather_dict.h"
+
+#define PIPELINE_ALERT_AQI 150 // Records the filter stage forwards as alerts
+
+// Run this rank's stage of a two-queue pipeline (PIPELINE_MODE). Rank 0
+// enqueues num_items test records on the queue "raw", ranks 1 to size-2
+// filter them and forward the records with an AQI of at least
+// PIPELINE_ALERT_AQI to the queue "alerts", and the last rank prints the
+// alerts. Both queues are created in one registry (see ffq_registry.h);
+// "alerts" has every filter as a producer. Needs at least 3 ranks
+// (collective over comm).
+void run_pipeline(WeatherDict *dict, MPI_Comm comm, int queue_size, int num_items,
+                  const WaitPolicy *wait, int producer_delay_ms, int consumer_delay_ms);
+
+#endif // PIPELINE_MODE_H
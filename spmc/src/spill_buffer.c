@@ -0,0 +1,118 @@
+#include "spill_buffer.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Size the file for capacity records and map all of it
+static bool spill_buffer_map(SpillBuffer* spill, size_t capacity) {
+    if (ftruncate(spill->fd, (off_t)(capacity * sizeof(WeatherRecord))) != 0) {
+        return false;
+    }
+    void* records = mmap(NULL, capacity * sizeof(WeatherRecord), PROT_READ | PROT_WRITE, 
+                         MAP_SHARED, spill->fd, 0);
+    if (records == MAP_FAILED) {
+        return false;
+    }
+    
+    if (spill->records) {
+        munmap(spill->records, spill->capacity * sizeof(WeatherRecord));
+    }
+    spill->records = (WeatherRecord*)records;
+    spill->capacity = capacity;
+    return true;
+}
+
+SpillBuffer* spill_buffer_create(const char* path) {
+    SpillBuffer* spill = (SpillBuffer*)malloc(sizeof(SpillBuffer));
+    spill->records = NULL;
+    spill->capacity = 0;
+    spill->head = 0;
+    spill->count = 0;
+    strncpy(spill->path, path, sizeof(spill->path) - 1);
+    spill->path[sizeof(spill->path) - 1] = '\0';
+    
+    spill->fd = open(spill->path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (spill->fd < 0) {
+        printf("Cannot create spill file %s\n", spill->path);
+        free(spill);
+        return NULL;
+    }
+    if (!spill_buffer_map(spill, SPILL_BUFFER_INITIAL_RECORDS)) {
+        printf("Cannot map spill file %s\n", spill->path);
+        close(spill->fd);
+        unlink(spill->path);
+        free(spill);
+        return NULL;
+    }
+    return spill;
+}
+
+bool spill_buffer_append(SpillBuffer* spill, const WeatherRecord* records, int n) {
+    size_t capacity = spill->capacity;
+    while (spill->count + n > capacity) {
+        capacity *= 2;
+    }
+    if (capacity > spill->capacity) {
+        size_t old_capacity = spill->capacity;
+        if (!spill_buffer_map(spill, capacity)) {
+            return false;
+        }
+        // Records wrapped to the front move behind the old end, where
+        // they follow the rest in slot order again
+        size_t wrapped = spill->head + spill->count > old_capacity ? 
+                         spill->head + spill->count - old_capacity : 0;
+        memcpy(&spill->records[old_capacity], spill->records, wrapped * sizeof(WeatherRecord));
+    }
+    
+    // Copy in up to two pieces, the second one wrapping to the front
+    size_t tail = (spill->head + spill->count) % spill->capacity;
+    size_t first = spill->capacity - tail < (size_t)n ? spill->capacity - tail : (size_t)n;
+    memcpy(&spill->records[tail], records, first * sizeof(WeatherRecord));
+    memcpy(spill->records, records + first, (n - first) * sizeof(WeatherRecord));
+    spill->count += n;
+    return true;
+}
+
+size_t spill_buffer_count(const SpillBuffer* spill) {
+    return spill->count;
+}
+
+int spill_buffer_drain(SpillBuffer* spill, FFQHandle* handle, int batch) {
+    int drained = 0;
+    
+    while (spill->count > 0) {
+        int n = ffq_credit(handle);
+        if (n == 0) {
+            break;
+        }
+        if (n > batch) {
+            n = batch;
+        }
+        if ((size_t)n > spill->count) {
+            n = (int)spill->count;
+        }
+        // A batch stops at the end of the file, the rest follows from
+        // its start
+        if ((size_t)n > spill->capacity - spill->head) {
+            n = (int)(spill->capacity - spill->head);
+        }
+        
+        ffq_enqueue_batch(handle, &spill->records[spill->head], n);
+        spill->head = (spill->head + n) % spill->capacity;
+        spill->count -= n;
+        drained += n;
+    }
+    return drained;
+}
+
+void spill_buffer_free(SpillBuffer* spill) {
+    if (spill) {
+        munmap(spill->records, spill->capacity * sizeof(WeatherRecord));
+        close(spill->fd);
+        unlink(spill->path);
+        free(spill);
+    }
+}
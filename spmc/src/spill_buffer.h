@@ -0,0 +1,45 @@
+#ifndef SPILL_BUFFER_H
+#define SPILL_BUFFER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "ffq.h"
+
+#define SPILL_BUFFER_INITIAL_RECORDS 4096
+
+// Overflow stage of a producer: records the queue has no credit for (see
+// ffq_credit) are appended to a local binary file, memory-mapped so an
+// append is a copy, and fed back to the queue as cells free up. Records
+// leave in the order they came in. The file is a ring: appends wrap
+// around its end into the space drained records left, and it only grows,
+// by doubling, when the backlog itself outgrows it.
+typedef struct
+{
+    int fd;
+    WeatherRecord *records;   // Mapping of the whole file
+    size_t capacity;          // Records the file holds
+    size_t head;              // Slot of the next record to feed back
+    size_t count;             // Records appended and not fed back yet
+    char path[256];
+} SpillBuffer;
+
+// Create an empty spill file at path, replacing any file there (local).
+// Returns NULL if it cannot be created or mapped.
+SpillBuffer *spill_buffer_create(const char *path);
+
+// Append n records. Returns false, appending nothing, if the file
+// cannot grow to hold them.
+bool spill_buffer_append(SpillBuffer *spill, const WeatherRecord *records, int n);
+
+// Records appended and not fed back yet
+size_t spill_buffer_count(const SpillBuffer *spill);
+
+// Enqueue spilled records, in batches of at most batch, as long as the
+// queue has credit for them; never waits for consumers (for producer).
+// Returns the number enqueued.
+int spill_buffer_drain(SpillBuffer *spill, FFQHandle *handle, int batch);
+
+// Unmap, close and remove the spill file
+void spill_buffer_free(SpillBuffer *spill);
+
+#endif // SPILL_BUFFER_H
@@ -17,36 +17,50 @@ WeatherData generate_test_data(int item_number) {
     return data;
 }
 
-void run_producer(FFQueue* queue, int num_items, int delay_ms, MPI_Win win) {
-    printf("Producer started\n");
-    
+void fill_test_dict(WeatherDict* dict, int num_items) {
     for (int i = 0; i < num_items; i++) {
-        WeatherData item = generate_test_data(i + 1);
-        ffq_enqueue(queue, item, win);
+        WeatherData data = generate_test_data(i + 1);
+        weather_dict_intern(dict, data.city);
+        weather_dict_intern(dict, data.weather_icon);
+    }
+}
+
+void run_producer(FFQHandle* handle, WeatherDict* dict, MPI_Comm producers, int num_items, int delay_ms) {
+    int producer_id, num_producers;
+    MPI_Comm_rank(producers, &producer_id);
+    MPI_Comm_size(producers, &num_producers);
+    printf("Producer %d started\n", producer_id);
+    
+    for (int i = producer_id; i < num_items; i += num_producers) {
+        WeatherData data = generate_test_data(i + 1);
+        WeatherRecord item;
+        weather_record_pack(dict, &data, &item);
+        ffq_enqueue(handle, item);
         do_work(delay_ms);
     }
     
-    printf("Producer finished\n");
+    ffq_publish_tail(handle);
+    printf("Producer %d finished\n", producer_id);
 }
 
-void run_consumer(FFQueue* queue, int consumer_id, int num_items, int delay_ms, MPI_Win win) {
+void run_consumer(FFQHandle* handle, WeatherDict* dict, int consumer_id, int num_items, int delay_ms) {
     printf("Consumer %d started\n", consumer_id);
     
     while (true) {
         // Check if we should stop
         int lastItem = 0;
-        MPI_Win_lock(MPI_LOCK_SHARED, 0, 0, win);
-        MPI_Get(&lastItem, 1, MPI_INT, 0, offsetof(FFQueue, lastItemDequeued), 1, MPI_INT, win);
-        MPI_Win_flush(0, win);
-        MPI_Win_unlock(0, win);
+        MPI_Fetch_and_op(NULL, &lastItem, MPI_INT, 0, FFQ_FIELD_DISP(handle, lastItemDequeued), MPI_NO_OP, handle->win);
+        MPI_Win_flush(0, handle->win);
         
         if (lastItem >= num_items) {
             break;
         }
         
-        WeatherData item;
-        if (ffq_dequeue(queue, consumer_id, &item, win)) {
-            print_weather_data(&item);
+        WeatherRecord item;
+        if (ffq_dequeue(handle, consumer_id, &item)) {
+            WeatherData data;
+            weather_record_unpack(dict, &item, &data);
+            print_weather_data(&data);
             do_work(delay_ms);
         }
     }
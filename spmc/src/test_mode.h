@@ -5,14 +5,19 @@
 #include <mpi.h>
 #include "ffq.h"
 #include "weather_data.h"
+#include "weather_dict.h"
 
 // Generate test data for TEST_MODE
 WeatherData generate_test_data(int item_number);
 
-// Run producer in test mode
-void run_producer(FFQueue *queue, int num_items, int delay_ms, MPI_Win win);
+// Add the strings of the generated test data to the dictionary
+void fill_test_dict(WeatherDict *dict, int num_items);
+
+// Run producer in test mode. With several producers (the ranks of
+// producers) each one enqueues every n-th item.
+void run_producer(FFQHandle *handle, WeatherDict *dict, MPI_Comm producers, int num_items, int delay_ms);
 
 // Run consumer in test mode
-void run_consumer(FFQueue *queue, int consumer_id, int num_items, int delay_ms, MPI_Win win);
+void run_consumer(FFQHandle *handle, WeatherDict *dict, int consumer_id, int num_items, int delay_ms);
 
 #endif // TEST_MODE_H
\ No newline at end of file
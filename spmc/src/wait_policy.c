@@ -0,0 +1,96 @@
+#include "wait_policy.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+
+static const char* kind_names[] = {"spin", "yield", "backoff", "block"};
+
+WaitPolicy wait_policy_default(void) {
+    WaitPolicy policy = {WAIT_BLOCK, WAIT_DEFAULT_MIN_US, WAIT_DEFAULT_MAX_US};
+    return policy;
+}
+
+bool wait_policy_parse(const char* spec, WaitPolicy* policy) {
+    *policy = wait_policy_default();
+
+    for (int kind = WAIT_SPIN; kind <= WAIT_BLOCK; kind++) {
+        size_t len = strlen(kind_names[kind]);
+        if (strncmp(spec, kind_names[kind], len) != 0) {
+            continue;
+        }
+        policy->kind = (WaitKind)kind;
+
+        const char* bounds = spec + len;
+        if (*bounds == '\0') {
+            return true;
+        }
+
+        // Only sleeping policies take bounds
+        int consumed = 0;
+        if ((kind == WAIT_BACKOFF || kind == WAIT_BLOCK) &&
+            sscanf(bounds, ":%d,%d%n", &policy->min_us, &policy->max_us, &consumed) == 2 &&
+            bounds[consumed] == '\0') {
+            return policy->min_us > 0 && policy->max_us >= policy->min_us;
+        }
+        return false;
+    }
+    return false;
+}
+
+void wait_policy_format(const WaitPolicy* policy, char* buf, size_t len) {
+    if (policy->kind == WAIT_BACKOFF || policy->kind == WAIT_BLOCK) {
+        snprintf(buf, len, "%s:%d,%d", kind_names[policy->kind], policy->min_us, policy->max_us);
+    } else {
+        snprintf(buf, len, "%s", kind_names[policy->kind]);
+    }
+}
+
+void waiter_init(Waiter* waiter, const WaitPolicy* policy) {
+    waiter->policy = policy;
+    waiter->delay_us = policy->min_us;
+    waiter->polls = 0;
+}
+
+static void cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+void waiter_pause(Waiter* waiter) {
+    int polls = waiter->polls++;
+    switch (waiter->policy->kind) {
+        case WAIT_SPIN:
+            cpu_relax();
+            break;
+        case WAIT_YIELD:
+            if (polls < WAIT_SPIN_POLLS) {
+                cpu_relax();
+            } else {
+                sched_yield();
+            }
+            break;
+        case WAIT_BLOCK:
+            if (polls < WAIT_BLOCK_POLLS) {
+                sched_yield();
+                break;
+            }
+            // Nothing to block on here, fall back to sleeping
+            // fall through
+        default:
+            usleep(waiter->delay_us);
+            waiter->delay_us = waiter->delay_us * 2 > waiter->policy->max_us
+                               ? waiter->policy->max_us : waiter->delay_us * 2;
+            break;
+    }
+}
+
+void waiter_reset(Waiter* waiter) {
+    waiter->delay_us = waiter->policy->min_us;
+    waiter->polls = 0;
+}
+
+bool waiter_should_block(const Waiter* waiter) {
+    return waiter->policy->kind == WAIT_BLOCK && waiter->polls >= WAIT_BLOCK_POLLS;
+}
@@ -0,0 +1,59 @@
+#ifndef WAIT_POLICY_H
+#define WAIT_POLICY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define WAIT_DEFAULT_MIN_US 100
+#define WAIT_DEFAULT_MAX_US 10000
+#define WAIT_SPIN_POLLS 64  // Busy polls before a yield policy yields
+#define WAIT_BLOCK_POLLS 16 // Yielding polls before a block policy blocks
+
+// How a retry loop waits before looking again
+typedef enum
+{
+    WAIT_SPIN,    // Busy poll, for ranks pinned to dedicated cores
+    WAIT_YIELD,   // Spin briefly, then give the core away with sched_yield
+    WAIT_BACKOFF, // Sleep, doubling from min_us up to max_us
+    WAIT_BLOCK    // Yield briefly, then block until notified where the queue
+                  // can notify (consumers waiting for a publish), backoff elsewhere
+} WaitKind;
+
+typedef struct
+{
+    WaitKind kind;
+    int min_us; // Backoff bounds (backoff and block)
+    int max_us;
+} WaitPolicy;
+
+// State of one wait loop
+typedef struct
+{
+    const WaitPolicy *policy;
+    int delay_us; // Next backoff sleep
+    int polls;    // Waits since the last reset
+} Waiter;
+
+// The default policy: block, with the default backoff bounds
+WaitPolicy wait_policy_default(void);
+
+// Parse "spin", "yield", "backoff[:min,max]" or "block[:min,max]"
+// (bounds in microseconds). Returns false if spec is not a policy.
+bool wait_policy_parse(const char *spec, WaitPolicy *policy);
+
+// Format a policy the way wait_policy_parse accepts it
+void wait_policy_format(const WaitPolicy *policy, char *buf, size_t len);
+
+void waiter_init(Waiter *waiter, const WaitPolicy *policy);
+
+// Wait once before the next retry
+void waiter_pause(Waiter *waiter);
+
+// Progress was made, start over from the shortest wait
+void waiter_reset(Waiter *waiter);
+
+// True once a block policy is past its yielding phase: the caller should
+// block on its notification now instead of calling waiter_pause
+bool waiter_should_block(const Waiter *waiter);
+
+#endif // WAIT_POLICY_H
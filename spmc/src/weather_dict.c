@@ -0,0 +1,186 @@
+#include "weather_dict.h"
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+
+// FNV-1a over the stored (possibly truncated) form of the string
+static uint32_t hash_string(const char* str) {
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < WEATHER_DICT_MAX_LEN - 1 && str[i] != '\0'; i++) {
+        hash ^= (unsigned char)str[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Slot of str: the one holding it, or the free one ending its probe chain.
+// Linear probing; the table is never more than half full
+static uint32_t find_slot(const WeatherDict* dict, const char* str) {
+    uint32_t slot = hash_string(str) & (WEATHER_DICT_HASH_SLOTS - 1);
+    while (dict->slots[slot] >= 0 &&
+           strncmp(dict->strings[dict->slots[slot]], str, WEATHER_DICT_MAX_LEN - 1) != 0) {
+        slot = (slot + 1) & (WEATHER_DICT_HASH_SLOTS - 1);
+    }
+    return slot;
+}
+
+// Hash the entries from the first one not indexed yet up to last
+static void index_entries(WeatherDict* dict, int last) {
+    for (int id = dict->indexed; id < last; id++) {
+        if (id != WEATHER_DICT_UNKNOWN) {
+            dict->slots[find_slot(dict, dict->strings[id])] = (int16_t)id;
+        }
+    }
+    dict->indexed = last;
+}
+
+// Pull the entries added since the last refresh
+static void refresh(WeatherDict* dict) {
+    int count;
+    MPI_Fetch_and_op(NULL, &count, MPI_INT, dict->owner,
+                     offsetof(WeatherDict, count), MPI_NO_OP, dict->win);
+    MPI_Win_flush(dict->owner, dict->win);
+
+    if (count > dict->indexed) {
+        if (dict->replica) {
+            // Entries are appended contiguously, so all new ones come in one Get
+            int added = count - dict->count;
+            MPI_Get(dict->strings[dict->count], added * WEATHER_DICT_MAX_LEN, MPI_CHAR,
+                    dict->owner, offsetof(WeatherDict, strings[dict->count]),
+                    added * WEATHER_DICT_MAX_LEN, MPI_CHAR, dict->win);
+            MPI_Win_flush(dict->owner, dict->win);
+            dict->count = count;
+        } else {
+            // Other ranks wrote them into this window
+            MPI_Win_sync(dict->win);
+        }
+        index_entries(dict, count);
+    }
+}
+
+// Add str to the owner's entries: reserve the next id, write the string
+// there and publish it once every lower id is published, so the count
+// only ever covers written entries. Returns WEATHER_DICT_UNKNOWN when full.
+static uint16_t add_entry(WeatherDict* dict, const char* str) {
+    const int one = 1;
+    int id;
+    MPI_Fetch_and_op(&one, &id, MPI_INT, dict->owner,
+                     offsetof(WeatherDict, reserved), MPI_SUM, dict->win);
+    MPI_Win_flush(dict->owner, dict->win);
+    if (id >= WEATHER_DICT_MAX_ENTRIES) {
+        return WEATHER_DICT_UNKNOWN;
+    }
+
+    // A replica's own copy of the entry is the source of the Put
+    strncpy(dict->strings[id], str, WEATHER_DICT_MAX_LEN - 1);
+    dict->strings[id][WEATHER_DICT_MAX_LEN - 1] = '\0';
+    if (dict->replica) {
+        MPI_Put(dict->strings[id], WEATHER_DICT_MAX_LEN, MPI_CHAR,
+                dict->owner, offsetof(WeatherDict, strings[id]),
+                WEATHER_DICT_MAX_LEN, MPI_CHAR, dict->win);
+        MPI_Win_flush(dict->owner, dict->win);
+    } else {
+        // Written locally, order it before the new count
+        MPI_Win_sync(dict->win);
+    }
+
+    // Lower ids reserved by other ranks are published within a few round
+    // trips, so wait for the count to reach this one
+    int next = id + 1;
+    int seen;
+    do {
+        MPI_Compare_and_swap(&next, &id, &seen, MPI_INT, dict->owner,
+                             offsetof(WeatherDict, count), dict->win);
+        MPI_Win_flush(dict->owner, dict->win);
+    } while (seen != id);
+    return (uint16_t)id;
+}
+
+void weather_dict_init(WeatherDict* dict) {
+    dict->count = 1;
+    dict->reserved = 1;
+    dict->indexed = 1;
+    dict->strings[WEATHER_DICT_UNKNOWN][0] = '\0';
+    for (int i = 0; i < WEATHER_DICT_HASH_SLOTS; i++) {
+        dict->slots[i] = -1;
+    }
+    dict->win = MPI_WIN_NULL;
+    dict->owner = 0;
+    dict->shared = false;
+    dict->replica = false;
+}
+
+uint16_t weather_dict_intern(WeatherDict* dict, const char* str) {
+    if (str[0] == '\0') {
+        return WEATHER_DICT_UNKNOWN;
+    }
+
+    uint32_t slot = find_slot(dict, str);
+    if (dict->slots[slot] < 0 && dict->shared) {
+        // Another rank may have added it since the last refresh
+        refresh(dict);
+        slot = find_slot(dict, str);
+    }
+    if (dict->slots[slot] >= 0) {
+        return (uint16_t)dict->slots[slot];
+    }
+
+    uint16_t id = WEATHER_DICT_UNKNOWN;
+    if (dict->shared) {
+        id = add_entry(dict, str);
+        if (id != WEATHER_DICT_UNKNOWN) {
+            // Indexes it along with whatever other ranks added meanwhile
+            refresh(dict);
+        }
+    } else if (dict->count < WEATHER_DICT_MAX_ENTRIES) {
+        id = (uint16_t)dict->count;
+        strncpy(dict->strings[id], str, WEATHER_DICT_MAX_LEN - 1);
+        dict->strings[id][WEATHER_DICT_MAX_LEN - 1] = '\0';
+        dict->slots[slot] = (int16_t)id;
+        dict->count = id + 1;
+        dict->reserved = dict->count;
+        dict->indexed = dict->count;
+    }
+
+    if (id == WEATHER_DICT_UNKNOWN) {
+        fprintf(stderr, "Warning: string dictionary full, '%s' stored as unknown\n", str);
+    }
+    return id;
+}
+
+const char* weather_dict_lookup(WeatherDict* dict, uint16_t id) {
+    if (id >= dict->count && dict->shared) {
+        refresh(dict);
+    }
+    if (id >= dict->count) {
+        return dict->strings[WEATHER_DICT_UNKNOWN];
+    }
+    return dict->strings[id];
+}
+
+void weather_dict_share(WeatherDict* dict, int owner, MPI_Comm comm) {
+    // Bulk copy of the entries known up front; only filled ones are sent
+    MPI_Bcast(&dict->count, 1, MPI_INT, owner, comm);
+    MPI_Bcast(dict->strings, dict->count * WEATHER_DICT_MAX_LEN, MPI_CHAR, owner, comm);
+    dict->reserved = dict->count;
+
+    MPI_Win_create(dict, sizeof(WeatherDict), 1, MPI_INFO_NULL, comm, &dict->win);
+    MPI_Win_lock_all(0, dict->win);
+    dict->owner = owner;
+    dict->shared = true;
+
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+    dict->replica = rank != owner;
+    if (dict->replica) {
+        index_entries(dict, dict->count);
+    }
+}
+
+void weather_dict_unshare(WeatherDict* dict) {
+    if (dict->shared) {
+        MPI_Win_unlock_all(dict->win);
+        MPI_Win_free(&dict->win);
+        dict->shared = false;
+    }
+}
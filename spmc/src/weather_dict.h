@@ -0,0 +1,54 @@
+#ifndef WEATHER_DICT_H
+#define WEATHER_DICT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <mpi.h>
+
+#define WEATHER_DICT_MAX_ENTRIES 1024
+#define WEATHER_DICT_HASH_SLOTS 2048 // Power of two, at least 2x the entries
+#define WEATHER_DICT_MAX_LEN 64
+#define WEATHER_DICT_UNKNOWN 0 // Id 0 is the empty string, used for misses
+
+// String dictionary mapping city names and icon paths to small ids.
+// Strings are interned through an open-addressing hash table. Entries
+// are append-only: the initial set is broadcast once and entries added
+// later live in the owner rank's window, from which other ranks pull every
+// new entry in one Get the first time they meet an unknown id. Any rank
+// adds an entry there by reserving an id with an atomic increment,
+// writing the string and then publishing it, in id order, by advancing
+// the owner's count (see weather_dict_intern).
+typedef struct
+{
+    int count;                  // Entries valid locally (published on the owner)
+    int reserved;               // Ids handed out so far (on the owner, once shared)
+    int indexed;                // Entries hashed into slots
+    char strings[WEATHER_DICT_MAX_ENTRIES][WEATHER_DICT_MAX_LEN];
+    int16_t slots[WEATHER_DICT_HASH_SLOTS]; // Id per slot, -1 if free
+    MPI_Win win;                // Exposes count and strings once shared
+    int owner;                  // Rank whose window holds the entries
+    bool shared;                // Window created by weather_dict_share
+    bool replica;               // Shared from another rank
+} WeatherDict;
+
+// Initialize an empty dictionary (holding only the empty string)
+void weather_dict_init(WeatherDict *dict);
+
+// Return the id of str, adding it if needed. Once shared, every rank adds
+// strings to the owner's entries; a string two ranks add at the same time
+// may get two ids, both resolving to it. Returns WEATHER_DICT_UNKNOWN when
+// the dictionary is full.
+uint16_t weather_dict_intern(WeatherDict *dict, const char *str);
+
+// Return the string for id ("" for unknown ids). Ids added after the last
+// refresh are pulled from the owner's window.
+const char *weather_dict_lookup(WeatherDict *dict, uint16_t id);
+
+// Replicate the dictionary of owner to every rank of comm and open the
+// window through which later entries are published (collective)
+void weather_dict_share(WeatherDict *dict, int owner, MPI_Comm comm);
+
+// Free the window created by weather_dict_share (collective)
+void weather_dict_unshare(WeatherDict *dict);
+
+#endif // WEATHER_DICT_H
@@ -0,0 +1,91 @@
+#include "weather_record.h"
+#include <stdio.h>
+#include <ctype.h>
+#include <time.h>
+
+// Days since 1970-01-01 of a proleptic Gregorian date
+static int64_t days_from_civil(int year, int month, int day) {
+    year -= month <= 2;
+    int64_t era = (year >= 0 ? year : year - 399) / 400;
+    int64_t yoe = year - era * 400;
+    int64_t doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    int64_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
+
+bool parse_timestamp_us(const char* str, int64_t* timestamp_us) {
+    int year, month, day, hour, minute, second, consumed = 0;
+    if (sscanf(str, "%4d-%2d-%2dT%2d:%2d:%2d%n",
+               &year, &month, &day, &hour, &minute, &second, &consumed) != 6) {
+        return false;
+    }
+    const char* p = str + consumed;
+
+    // Optional fraction, kept to microsecond precision
+    int64_t micros = 0;
+    if (*p == '.') {
+        int digits = 0;
+        for (p++; isdigit((unsigned char)*p); p++) {
+            if (digits++ < 6) {
+                micros = micros * 10 + (*p - '0');
+            }
+        }
+        for (; digits < 6; digits++) {
+            micros *= 10;
+        }
+    }
+
+    // Optional UTC offset
+    int64_t offset_s = 0;
+    if (*p == '+' || *p == '-') {
+        int off_h = 0, off_m = 0;
+        if (sscanf(p + 1, "%2d:%2d", &off_h, &off_m) < 1) {
+            return false;
+        }
+        offset_s = (off_h * 3600 + off_m * 60) * (*p == '-' ? -1 : 1);
+    }
+
+    int64_t seconds = days_from_civil(year, month, day) * 86400
+                      + hour * 3600 + minute * 60 + second - offset_s;
+    *timestamp_us = seconds * 1000000 + micros;
+    return true;
+}
+
+void format_timestamp_us(int64_t timestamp_us, char* buf, size_t len) {
+    time_t seconds = (time_t)(timestamp_us / 1000000);
+    int micros = (int)(timestamp_us % 1000000);
+    if (micros < 0) {
+        seconds--;
+        micros += 1000000;
+    }
+
+    struct tm tm;
+    gmtime_r(&seconds, &tm);
+    snprintf(buf, len, "%04d-%02d-%02dT%02d:%02d:%02d.%06d+00:00",
+             tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
+             tm.tm_hour, tm.tm_min, tm.tm_sec, micros);
+}
+
+void weather_record_pack(WeatherDict* dict, const WeatherData* data, WeatherRecord* record) {
+    memset(record, 0, sizeof(WeatherRecord));
+    if (!parse_timestamp_us(data->timestamp, &record->timestamp_us)) {
+        record->timestamp_us = 0;
+    }
+    record->wind_speed = data->wind_speed;
+    record->city_id = weather_dict_intern(dict, data->city);
+    record->icon_id = weather_dict_intern(dict, data->weather_icon);
+    record->aqi = (int16_t)data->aqi;
+    record->humidity = (uint8_t)data->humidity;
+    record->flags = data->valid ? WEATHER_RECORD_VALID : 0;
+}
+
+void weather_record_unpack(WeatherDict* dict, const WeatherRecord* record, WeatherData* data) {
+    memset(data, 0, sizeof(WeatherData));
+    format_timestamp_us(record->timestamp_us, data->timestamp, MAX_TIMESTAMP_LEN);
+    strncpy(data->city, weather_dict_lookup(dict, record->city_id), MAX_CITY_LEN - 1);
+    strncpy(data->weather_icon, weather_dict_lookup(dict, record->icon_id), MAX_ICON_LEN - 1);
+    data->aqi = record->aqi;
+    data->wind_speed = record->wind_speed;
+    data->humidity = record->humidity;
+    data->valid = (record->flags & WEATHER_RECORD_VALID) != 0;
+}
@@ -0,0 +1,38 @@
+#ifndef WEATHER_RECORD_H
+#define WEATHER_RECORD_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "weather_data.h"
+#include "weather_dict.h"
+
+#define WEATHER_RECORD_VALID 0x01
+#define WEATHER_RECORD_SENTINEL 0x02 // End-of-stream marker
+
+// Compact wire format of WeatherData as carried by the queue (24 bytes).
+// Strings are replaced by ids in the replicated WeatherDict.
+typedef struct
+{
+    int64_t timestamp_us; // Microseconds since the Unix epoch (UTC)
+    float wind_speed;
+    uint16_t city_id;
+    uint16_t icon_id;
+    int16_t aqi;
+    uint8_t humidity;
+    uint8_t flags;
+} WeatherRecord;
+
+// Parse an ISO 8601 timestamp ("2025-05-01T00:01:55.161089+07:00").
+// Returns false if the string is not a timestamp.
+bool parse_timestamp_us(const char *str, int64_t *timestamp_us);
+
+// Format a timestamp as ISO 8601 in UTC (needs MAX_TIMESTAMP_LEN bytes)
+void format_timestamp_us(int64_t timestamp_us, char *buf, size_t len);
+
+// Pack a record, interning its strings in dict
+void weather_record_pack(WeatherDict *dict, const WeatherData *data, WeatherRecord *record);
+
+// Unpack a record, resolving its ids in dict
+void weather_record_unpack(WeatherDict *dict, const WeatherRecord *record, WeatherData *data);
+
+#endif // WEATHER_RECORD_H